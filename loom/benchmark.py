@@ -29,6 +29,7 @@
 import os
 import shutil
 import glob
+import time
 import parsable
 from distributions.io.stream import (
     open_compressed,
@@ -74,10 +75,12 @@ def generate(
         row_count=10000,
         feature_count=100,
         density=0.5,
+        parallel=False,
         debug=False,
         profile='time'):
     '''
     Generate a synthetic dataset.
+    Pass parallel=true to sample kinds in parallel; this changes the rows.
     '''
     name = '{}-{}-{}-{}'.format(
         feature_type,
@@ -95,6 +98,7 @@ def generate(
         rows_out=results['ingest']['rows'],
         model_out=results['samples'][0]['model'],
         groups_out=results['samples'][0]['groups'],
+        parallel=parallel,
         debug=debug,
         profile=profile)
     loom.format.make_schema(
@@ -154,7 +158,7 @@ def ingest(name=None, debug=False, profile='time'):
 
 
 @parsable.command
-def tare(name=None, debug=False, profile='time'):
+def tare(name=None, tare_count=1, debug=False, profile='time'):
     '''
     Find tare rows.
     '''
@@ -165,6 +169,7 @@ def tare(name=None, debug=False, profile='time'):
         schema_row_in=inputs['ingest']['schema_row'],
         rows_in=inputs['ingest']['rows'],
         tares_out=results['ingest']['tares'],
+        tare_count=tare_count,
         debug=debug,
         profile=profile)
 
@@ -231,6 +236,7 @@ def infer(
         name=None,
         extra_passes=loom.config.DEFAULTS['schedule']['extra_passes'],
         parallel=True,
+        incremental_tare_cache=True,
         debug=False,
         profile='time'):
     '''
@@ -240,7 +246,10 @@ def infer(
     loom.store.require(name, ['samples.0.init', 'samples.0.shuffled'])
     inputs, results = get_paths(name, 'infer')
 
-    config = {'schedule': {'extra_passes': extra_passes}}
+    config = {
+        'schedule': {'extra_passes': extra_passes},
+        'incremental_tare_cache': incremental_tare_cache,
+    }
     if not parallel:
         loom.config.fill_in_sequential(config)
     loom.config.config_dump(config, results['samples'][0]['config'])
@@ -273,6 +282,29 @@ def infer(
     print 'group_counts: {}'.format(' '.join(map(str, group_counts)))
 
 
+@parsable.command
+def infer_tare_cache(
+        name=None,
+        extra_passes=loom.config.DEFAULTS['schedule']['extra_passes'],
+        parallel=True):
+    '''
+    Compare inference time with incremental vs full tare cache updates.
+    '''
+    times = {}
+    for incremental_tare_cache in [False, True]:
+        start = time.time()
+        infer(
+            name=name,
+            extra_passes=extra_passes,
+            parallel=parallel,
+            incremental_tare_cache=incremental_tare_cache,
+            profile=None)
+        times[incremental_tare_cache] = time.time() - start
+    print 'full tare cache: {:0.2f} sec'.format(times[False])
+    print 'incremental tare cache: {:0.2f} sec'.format(times[True])
+    print 'speedup: {:0.2f}x'.format(times[False] / times[True])
+
+
 def _load_checkpoint(step):
     message = loom.schema_pb2.Checkpoint()
     filename = checkpoint_files(step)['checkpoint']
@@ -32,9 +32,16 @@ from distributions.io.stream import open_compressed
 import loom.schema_pb2
 import loom.documented
 
+WAIT_STRATEGY = {
+    'block': loom.schema_pb2.Config.Kernels.BLOCK,
+    'spin': loom.schema_pb2.Config.Kernels.SPIN,
+    'adaptive': loom.schema_pb2.Config.Kernels.ADAPTIVE,
+}
+
 DEFAULTS = {
     'seed': 0,
     'target_mem_bytes': 4e9,
+    'incremental_tare_cache': True,
     'schedule': {
         'extra_passes': 500.0,
         'small_data_size': 4e3,
@@ -47,6 +54,13 @@ DEFAULTS = {
             'empty_group_count': 1,
             'row_queue_capacity': 255,
             'parser_threads': 6,
+            'unzip_threads': 2,
+            'prefetch_bytes': 2 ** 26,
+            'rows_per_task': 1,
+            'wait_strategy': WAIT_STRATEGY['block'],
+            'pin_threads': False,
+            'worker_threads': 0,
+            'single_pass_block_size': 32,
         },
         'hyper': {
             'run': True,
@@ -57,6 +71,12 @@ DEFAULTS = {
             'empty_kind_count': 32,
             'row_queue_capacity': 255,
             'parser_threads': 6,
+            'unzip_threads': 2,
+            'prefetch_bytes': 2 ** 26,
+            'rows_per_task': 1,
+            'wait_strategy': WAIT_STRATEGY['block'],
+            'pin_threads': False,
+            'worker_threads': 0,
             'score_parallel': True,
         },
     },
@@ -68,6 +88,7 @@ DEFAULTS = {
         'row_count': 100,
         'density': 0.5,
         'sample_skip': 10,
+        'parallel': False,
     },
     'query': {
         'parallel': True,
@@ -92,6 +113,7 @@ def fill_in_sequential(config):
     kernels['hyper']['parallel'] = False
     kernels['kind']['row_queue_capacity'] = 0
     kernels['kind']['parallel'] = False
+    config['generate']['parallel'] = False
 
 
 def protobuf_dump(config, message, warn='WARN ignoring config'):
@@ -147,10 +147,12 @@ def generate(
         groups_out=None,
         assign_out=None,
         init_out=None,
+        parallel=False,
         debug=False,
         profile=None):
     '''
     Generate a synthetic dataset.
+    Parallel sampling is faster but draws different rows for a given seed.
     '''
     root = os.getcwd()
     rows_out = os.path.abspath(rows_out)
@@ -171,7 +173,13 @@ def generate(
         with open_compressed(init_out, 'wb') as f:
             f.write(model.SerializeToString())
 
-        config = {'generate': {'row_count': row_count, 'density': density}}
+        config = {
+            'generate': {
+                'row_count': row_count,
+                'density': density,
+                'parallel': parallel,
+            },
+        }
         config_in = os.path.abspath('config.pb.gz')
         loom.config.config_dump(config, config_in)
 
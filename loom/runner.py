@@ -137,13 +137,15 @@ def tare(
         schema_row_in,
         rows_in,
         tares_out,
+        tare_count=1,
         debug=False,
         profile=None):
     '''
     Find tare rows for a datset, i.e., rows of per-column most-likely values.
+    With tare_count > 1, cluster rows into modes and find one tare per mode.
     '''
     check_call_files(
-        command=['tare', schema_row_in, rows_in, tares_out],
+        command=['tare', schema_row_in, rows_in, tares_out, tare_count],
         debug=debug,
         profile=profile,
         infiles=[schema_row_in, rows_in],
@@ -195,6 +197,41 @@ def shuffle(
         outfiles=[rows_out])
 
 
+@parsable.command
+def index(rows_in, stride=1024, debug=False, profile=None):
+    '''
+    Write a sidecar index rows_in.idx for fast seeking in a row stream.
+    '''
+    check_call_files(
+        command=['index', rows_in, stride],
+        debug=debug,
+        profile=profile,
+        infiles=[rows_in],
+        outfiles=[rows_in + '.idx'])
+
+
+@parsable.command
+def slice(
+        rows_in,
+        rows_out,
+        begin=0,
+        end=-1,
+        stride=1024,
+        debug=False,
+        profile=None):
+    '''
+    Copy messages [begin, end) of a row stream, converting formats by
+    extension, and index rows_out with the given stride.
+    '''
+    assert rows_in != rows_out, 'cannot slice rows in-place'
+    check_call_files(
+        command=['slice', rows_in, rows_out, begin, end, stride],
+        debug=debug,
+        profile=profile,
+        infiles=[rows_in],
+        outfiles=[rows_out])
+
+
 @parsable.command
 @loom.documented.transform(
     inputs=[
@@ -0,0 +1,88 @@
+# Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+# Copyright (c) 2015, Google, Inc.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+#
+# - Redistributions of source code must retain the above copyright
+#   notice, this list of conditions and the following disclaimer.
+# - Redistributions in binary form must reproduce the above copyright
+#   notice, this list of conditions and the following disclaimer in the
+#   documentation and/or other materials provided with the distribution.
+# - Neither the name of Salesforce.com nor the names of its contributors
+#   may be used to endorse or promote products derived from this
+#   software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+# LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+# FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+# COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+# INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+# BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+# OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+# ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+# TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+# USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+import os
+from nose import SkipTest
+from nose.tools import assert_equal
+from loom.test.util import CLEANUP_ON_ERROR
+from loom.test.util import for_each_dataset
+from distributions.fileutil import tempdir
+from distributions.io.stream import protobuf_stream_load
+import loom.config
+import loom.runner
+
+CONFIGS = [
+    {
+        'schedule': {'extra_passes': 0.0},
+    },
+    {
+        'schedule': {'extra_passes': 1.5},
+        'kernels': {
+            'cat': {'empty_group_count': 1},
+            'kind': {'iterations': 1},
+        },
+    },
+]
+
+
+def has_avx2():
+    # loom_infer_columnar is built with LOOM_COLUMNAR_ISA, by default -mavx2
+    with open('/proc/cpuinfo') as f:
+        return 'avx2' in f.read().split()
+
+
+@for_each_dataset
+def test_infer_columnar(tares, shuffled, init, **unused):
+    if not has_avx2():
+        raise SkipTest('cpu lacks avx2')
+    with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
+        row_count = sum(1 for _ in protobuf_stream_load(shuffled))
+        for config in CONFIGS:
+            loom.config.fill_in_defaults(config)
+            print 'config: {}'.format(config)
+            with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
+                config_in = os.path.abspath('config.pb.gz')
+                assign_out = os.path.abspath('assign.pbs.gz')
+                loom.config.config_dump(config, config_in)
+
+                # debug builds check each columnar score against
+                # the default scorer, in ProductMixture_::score_value
+                loom.runner.check_call_files(
+                    command=[
+                        'infer_columnar',
+                        config_in, shuffled, tares,
+                        init, '--none', '--none', '--none',
+                        '--none', '--none', assign_out, '--none', '--none',
+                    ],
+                    debug=True,
+                    profile=None,
+                    infiles=[config_in, shuffled, tares, init],
+                    outfiles=[assign_out])
+
+                assign_count = sum(1 for _ in protobuf_stream_load(assign_out))
+                assert_equal(assign_count, row_count)
@@ -32,6 +32,7 @@ from nose.tools import assert_true
 from loom.test.util import assert_found
 from loom.test.util import CLEANUP_ON_ERROR
 from loom.test.util import for_each_dataset
+from loom.test.util import load_rows
 from distributions.fileutil import tempdir
 from distributions.io.stream import open_compressed
 from distributions.io.stream import protobuf_stream_load
@@ -40,6 +41,8 @@ from loom.schema_pb2 import ProductModel
 import loom.config
 import loom.runner
 
+TARE_COUNT = 4
+
 CONFIGS = [
     {
         'schedule': {'extra_passes': 0.0},
@@ -186,6 +189,40 @@ def test_sparsify(rows, schema_row, **unused):
         assert_found(diffs)
 
 
+@for_each_dataset
+def test_sparsify_multiple_tares(rows, schema_row, **unused):
+    with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
+        tares = os.path.abspath('tares.pbs.gz')
+        diffs = os.path.abspath('diffs.pbs.gz')
+        loom.runner.tare(
+            schema_row_in=schema_row,
+            rows_in=rows,
+            tares_out=tares,
+            tare_count=TARE_COUNT)
+        assert_found(tares)
+        tare_count = sum(1 for _ in protobuf_stream_load(tares))
+        assert_true(tare_count <= TARE_COUNT)
+
+        # debug builds check that each diff maps back to its row
+        loom.runner.sparsify(
+            schema_row_in=schema_row,
+            tares_in=tares,
+            rows_in=rows,
+            rows_out=diffs,
+            debug=True)
+        assert_found(diffs)
+
+        expected_ids = [row.id for row in load_rows(rows)]
+        diff_rows = load_rows(diffs)
+        assert_equal([row.id for row in diff_rows], expected_ids)
+        for row in diff_rows:
+            if tare_count:
+                assert_equal(len(row.diff.tares), 1)
+                assert_true(row.diff.tares[0] < tare_count)
+            else:
+                assert_equal(len(row.diff.tares), 0)
+
+
 @for_each_dataset
 def test_shuffle(diffs, **unused):
     with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
@@ -81,3 +81,32 @@ def test_chunking(rows, **unused):
         for i, actual in enumerate(results):
             for expected in results[:i]:
                 assert_list_equal(actual, expected)
+
+
+@for_each_dataset
+def test_multi_bucket(rows, **unused):
+    with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
+        seed = 12345
+        in_memory = os.path.abspath('in_memory.pbs.gz')
+        bucketed = os.path.abspath('bucketed.pbs.gz')
+        loom.runner.shuffle(
+            rows_in=rows,
+            rows_out=in_memory,
+            seed=seed,
+            target_mem_bytes=1e9)
+        loom.runner.shuffle(
+            rows_in=rows,
+            rows_out=bucketed,
+            seed=seed,
+            target_mem_bytes=1e3)
+        assert_found(in_memory, bucketed)
+        temp_dirs = [name for name in os.listdir('.') if '.shuffle.' in name]
+        assert_equal(temp_dirs, [])
+
+        expected = load_rows_raw(in_memory)
+        actual = load_rows_raw(bucketed)
+        assert_list_equal(actual, expected)
+
+        original = sorted(row.id for row in load_rows(rows))
+        shuffled = sorted(row.id for row in load_rows(bucketed))
+        assert_list_equal(shuffled, original)
@@ -0,0 +1,150 @@
+# Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+# Copyright (c) 2015, Google, Inc.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+#
+# - Redistributions of source code must retain the above copyright
+#   notice, this list of conditions and the following disclaimer.
+# - Redistributions in binary form must reproduce the above copyright
+#   notice, this list of conditions and the following disclaimer in the
+#   documentation and/or other materials provided with the distribution.
+# - Neither the name of Salesforce.com nor the names of its contributors
+#   may be used to endorse or promote products derived from this
+#   software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+# LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+# FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+# COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+# INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+# BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+# OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+# ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+# TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+# USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+import os
+import shutil
+import struct
+import time
+from nose.tools import assert_equal, assert_list_equal, assert_true
+from distributions.fileutil import tempdir
+from distributions.io.stream import protobuf_stream_dump
+from loom.test.util import (
+    for_each_dataset,
+    CLEANUP_ON_ERROR,
+    assert_found,
+    load_rows_raw,
+)
+import loom.runner
+
+FORMATS = ['pbs', 'pbs.gz', 'pbsz']
+STRIDE = 7
+
+
+def load_index(filename):
+    with open(filename, 'rb') as f:
+        data = f.read()
+    assert_equal(data[:8], 'LOOMIDX1')
+    header = struct.unpack('<QQQQIIQQ', data[8:64])
+    offset_count, restart_count = header[-2:]
+    begin = 64 + 8 * offset_count
+    end = begin + 8 * restart_count
+    restarts = struct.unpack('<{}Q'.format(restart_count), data[begin:end])
+    return {
+        'message_count': header[3],
+        'stride': header[5],
+        'restarts': restarts,
+    }
+
+
+def get_intervals(row_count):
+    begins = [0, 1, STRIDE - 1, STRIDE, STRIDE + 1, row_count / 2]
+    begins += [row_count - 1, row_count]
+    return [(b, min(row_count, b + STRIDE + 2)) for b in begins]
+
+
+@for_each_dataset
+def test_round_trip(rows, **unused):
+    with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
+        expected = load_rows_raw(rows)
+        for ext in FORMATS:
+            written = os.path.abspath('rows.{}'.format(ext))
+            loom.runner.slice(rows, written, stride=STRIDE)
+            if ext != 'pbsz':
+                assert_found(written + '.idx')
+            read = os.path.abspath('read.{}.pbs.gz'.format(ext))
+            loom.runner.slice(written, read)
+            assert_list_equal(load_rows_raw(read), expected)
+
+
+@for_each_dataset
+def test_seek(rows, **unused):
+    with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
+        expected = load_rows_raw(rows)
+        for ext in FORMATS:
+            written = os.path.abspath('rows.{}'.format(ext))
+            loom.runner.slice(rows, written, stride=STRIDE)
+            for begin, end in get_intervals(len(expected)):
+                read = os.path.abspath('read.pbs')
+                loom.runner.slice(written, read, begin, end)
+                assert_list_equal(load_rows_raw(read), expected[begin:end])
+
+
+@for_each_dataset
+def test_seek_gzip_members(rows, **unused):
+    with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
+        expected = load_rows_raw(rows)
+        written = os.path.abspath('rows.pbs.gz')
+        loom.runner.slice(rows, written, stride=STRIDE)
+        index = load_index(written + '.idx')
+        assert_equal(index['message_count'], len(expected))
+        assert_equal(index['stride'], STRIDE)
+        restarts = index['restarts']
+        assert_equal(len(restarts), (len(expected) + STRIDE - 1) / STRIDE)
+        assert_true(len(restarts) > 1, 'too few rows to test gzip members')
+        with open(written, 'rb') as f:
+            data = f.read()
+        for restart in restarts:
+            assert_equal(data[restart:restart + 2], '\x1f\x8b')
+
+        for begin, end in get_intervals(len(expected)):
+            read = os.path.abspath('read.pbs')
+            loom.runner.slice(written, read, begin, end)
+            assert_list_equal(load_rows_raw(read), expected[begin:end])
+
+
+@for_each_dataset
+def test_stale_index(rows, **unused):
+    with tempdir(cleanup_on_error=CLEANUP_ON_ERROR):
+        expected = load_rows_raw(rows)
+        mtime = int(time.time()) - 100
+        indexed = os.path.abspath('indexed.pbs')
+        loom.runner.slice(rows, indexed, stride=STRIDE)
+        os.utime(indexed, (mtime, mtime))
+        loom.runner.index(indexed, stride=STRIDE)
+
+        # reversed rows have the same size but different message offsets,
+        # so seeking via the copied index would misparse them
+        reversed_rows = expected[::-1]
+        stale_mtime = os.path.abspath('stale_mtime.pbs')
+        protobuf_stream_dump(reversed_rows, stale_mtime)
+        shutil.copyfile(indexed + '.idx', stale_mtime + '.idx')
+        os.utime(stale_mtime, (mtime + 1, mtime + 1))
+        assert_equal(os.path.getsize(stale_mtime), os.path.getsize(indexed))
+
+        stale_size = os.path.abspath('stale_size.pbs')
+        protobuf_stream_dump(reversed_rows + expected[:1], stale_size)
+        shutil.copyfile(indexed + '.idx', stale_size + '.idx')
+        os.utime(stale_size, (mtime, mtime))
+
+        for stale, stale_rows in [
+                (stale_mtime, reversed_rows),
+                (stale_size, reversed_rows + expected[:1])]:
+            for begin, end in get_intervals(len(expected)):
+                read = os.path.abspath('read.pbs')
+                loom.runner.slice(stale, read, begin, end)
+                assert_list_equal(load_rows_raw(read), stale_rows[begin:end])
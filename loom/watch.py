@@ -109,6 +109,8 @@ def partial(log_file):
             'feature_counts: {}'.format(' '.join(feature_counts)),
             'category_counts: {}'.format(' '.join(category_counts)),
             'kernels:\n{}'.format(message.args.kernel_status),
+            'rows:\n{}'.format(message.args.rows),
+            'placement:\n{}'.format(message.args.placement),
             'rusage:\n{}'.format(message.rusage),
         ])
         print_page(part)
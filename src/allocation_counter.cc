@@ -0,0 +1,142 @@
+// Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+// Copyright (c) 2015, Google, Inc.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// - Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// - Neither the name of Salesforce.com nor the names of its contributors
+//   may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+// OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+// TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <loom/allocation_counter.hpp>
+
+#ifdef LOOM_COUNT_ALLOCATIONS
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace loom
+{
+
+namespace
+{
+
+// counts are sharded across cache lines so that threads rarely contend
+enum { shard_count = 64, cache_line_bytes = 64 };
+
+struct Shard
+{
+    std::atomic<uint64_t> count;
+    char padding[cache_line_bytes - sizeof(std::atomic<uint64_t>)];
+};
+
+Shard g_shards[shard_count];
+std::atomic<uint32_t> g_next_shard;
+
+inline void count_allocation ()
+{
+    static thread_local uint32_t shard =
+        g_next_shard.fetch_add(1, std::memory_order_relaxed) % shard_count;
+    g_shards[shard].count.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline void * counted_malloc (size_t size)
+{
+    count_allocation();
+    return malloc(size ? size : 1);
+}
+
+} // anonymous namespace
+
+uint64_t heap_allocation_count ()
+{
+    uint64_t count = 0;
+    for (const auto & shard : g_shards) {
+        count += shard.count.load(std::memory_order_relaxed);
+    }
+    return count;
+}
+
+} // namespace loom
+
+//----------------------------------------------------------------------------
+// Global allocation functions
+
+void * operator new (size_t size)
+{
+    if (void * ptr = loom::counted_malloc(size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void * operator new[] (size_t size)
+{
+    if (void * ptr = loom::counted_malloc(size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void * operator new (size_t size, const std::nothrow_t &) noexcept
+{
+    return loom::counted_malloc(size);
+}
+
+void * operator new[] (size_t size, const std::nothrow_t &) noexcept
+{
+    return loom::counted_malloc(size);
+}
+
+void operator delete (void * ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[] (void * ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete (void * ptr, const std::nothrow_t &) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[] (void * ptr, const std::nothrow_t &) noexcept
+{
+    free(ptr);
+}
+
+#else // LOOM_COUNT_ALLOCATIONS
+
+namespace loom
+{
+
+uint64_t heap_allocation_count ()
+{
+    return 0;
+}
+
+} // namespace loom
+
+#endif // LOOM_COUNT_ALLOCATIONS
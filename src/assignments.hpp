@@ -28,38 +28,168 @@
 
 #pragma once
 
-#include <deque>
+#include <cstdlib>
+#include <cstring>
 #include <utility>
+#include <sys/mman.h>
 #include <distributions/vector.hpp>
 #include <loom/common.hpp>
 
 namespace loom
 {
 
+// Zero-initialized storage for packed queues.  Large buffers are mmapped
+// and advised to use transparent huge pages, since queues of billions of
+// rows are accessed sequentially but span many pages.
+class PackedWords
+{
+public:
+
+    PackedWords () : data_(nullptr), size_(0) {}
+
+    explicit PackedWords (size_t size) :
+        data_(_allocate(size)),
+        size_(size)
+    {
+    }
+
+    PackedWords (const PackedWords & other) :
+        data_(_allocate(other.size_)),
+        size_(other.size_)
+    {
+        if (size_) {
+            memcpy(data_, other.data_, size_ * sizeof(uint64_t));
+        }
+    }
+
+    PackedWords (PackedWords && other) noexcept :
+        data_(nullptr),
+        size_(0)
+    {
+        swap(other);
+    }
+
+    PackedWords & operator= (PackedWords other) noexcept
+    {
+        swap(other);
+        return * this;
+    }
+
+    ~PackedWords () { _deallocate(data_, size_); }
+
+    void swap (PackedWords & other) noexcept
+    {
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+    }
+
+    size_t size () const { return size_; }
+    const uint64_t * data () const { return data_; }
+    uint64_t & operator[] (size_t i) { return data_[i]; }
+    const uint64_t & operator[] (size_t i) const { return data_[i]; }
+
+private:
+
+    enum { huge_page_bytes = 2UL << 20 };
+
+    static bool _is_mapped (size_t size)
+    {
+        return size * sizeof(uint64_t) >= huge_page_bytes;
+    }
+
+    static uint64_t * _allocate (size_t size)
+    {
+        if (size == 0) {
+            return nullptr;
+        }
+        const size_t bytes = size * sizeof(uint64_t);
+        void * data;
+        if (_is_mapped(size)) {
+            data = mmap(
+                nullptr,
+                bytes,
+                PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS,
+                -1,
+                0);
+            LOOM_ASSERT(data != MAP_FAILED, "failed to map " << bytes);
+#ifdef MADV_HUGEPAGE
+            madvise(data, bytes, MADV_HUGEPAGE);
+#endif // MADV_HUGEPAGE
+        } else {
+            data = calloc(size, sizeof(uint64_t));
+            LOOM_ASSERT(data, "failed to allocate " << bytes);
+        }
+        return static_cast<uint64_t *>(data);
+    }
+
+    static void _deallocate (uint64_t * data, size_t size)
+    {
+        if (data) {
+            if (_is_mapped(size)) {
+                munmap(data, size * sizeof(uint64_t));
+            } else {
+                free(data);
+            }
+        }
+    }
+
+    uint64_t * data_;
+    size_t size_;
+};
+
 class Assignments : noncopyable
 {
 public:
 
+    // A ring buffer of bit-packed values.  The bit width is a power of two,
+    // so that values never straddle words, and it grows as larger values
+    // are pushed; capacity doubles when full.  Global groupids grow over
+    // multi-pass runs, so groupid queues normally reach 32 bits.
     template<class T>
     class Queue
     {
     public:
 
-        bool empty () const { return queue_.empty(); }
-        size_t size () const { return queue_.size(); }
+        Queue () :
+            words_(),
+            head_(0),
+            size_(0),
+            capacity_(0),
+            log_width_(0)
+        {
+        }
 
-        const T & front () const { return queue_.front(); }
-        const T & back () const { return queue_.back(); }
-        const T & operator[] (size_t i) const { return queue_[i]; }
+        bool empty () const { return size_ == 0; }
+        size_t size () const { return size_; }
 
-        void clear () { queue_.clear(); }
+        T front () const { return (* this)[0]; }
+        T back () const { return (* this)[size_ - 1]; }
+        T operator[] (size_t i) const
+        {
+            LOOM_ASSERT2(i < size_, "index out of range: " << i);
+            return _get((head_ + i) & (capacity_ - 1));
+        }
 
-        void push (const T & t) { queue_.push_back(t); }
+        void clear ()
+        {
+            head_ = 0;
+            size_ = 0;
+        }
+
+        void push (const T & t)
+        {
+            if (LOOM_UNLIKELY(size_ == capacity_ or not _fits(t))) {
+                _grow(t);
+            }
+            _set((head_ + size_) & (capacity_ - 1), t);
+            ++size_;
+        }
 
         bool try_push (const T & t)
         {
             if (LOOM_UNLIKELY(empty()) or LOOM_LIKELY(t != front())) {
-                queue_.push_back(t);
+                push(t);
                 return true;
             } else {
                 return false;
@@ -70,17 +200,83 @@ public:
         {
             LOOM_ASSERT1(not empty(), "cannot pop from empty queue");
             const T t = front();
-            queue_.pop_front();
+            head_ = (head_ + 1) & (capacity_ - 1);
+            --size_;
             return t;
         }
 
-        typedef typename std::deque<T>::const_iterator iterator;
-        iterator begin () const { return queue_.begin(); }
-        iterator end () const { return queue_.end(); }
+        const void * data () const { return words_.data(); }
+
+        size_t memory_bytes () const
+        {
+            return words_.size() * sizeof(uint64_t);
+        }
 
     private:
 
-        std::deque<T> queue_;
+        enum {
+            min_capacity = 64,
+            max_log_width = sizeof(T) == 8 ? 6 : sizeof(T) == 4 ? 5 : 4
+        };
+
+        static uint64_t _mask (size_t log_width)
+        {
+            return log_width == 6 ? ~0UL : (1UL << (1UL << log_width)) - 1;
+        }
+
+        bool _fits (const T & t) const
+        {
+            return (static_cast<uint64_t>(t) & ~_mask(log_width_)) == 0;
+        }
+
+        T _get (size_t slot) const
+        {
+            const size_t log_per_word = 6 - log_width_;
+            const size_t word = slot >> log_per_word;
+            const size_t shift =
+                (slot & ((1UL << log_per_word) - 1)) << log_width_;
+            return static_cast<T>((words_[word] >> shift) & _mask(log_width_));
+        }
+
+        void _set (size_t slot, const T & t)
+        {
+            const size_t log_per_word = 6 - log_width_;
+            const size_t word = slot >> log_per_word;
+            const size_t shift =
+                (slot & ((1UL << log_per_word) - 1)) << log_width_;
+            const uint64_t mask = _mask(log_width_) << shift;
+            words_[word] = (words_[word] & ~mask)
+                         | (static_cast<uint64_t>(t) << shift);
+        }
+
+        void _grow (const T & t)
+        {
+            size_t log_width = log_width_;
+            while ((static_cast<uint64_t>(t) & ~_mask(log_width)) != 0) {
+                ++log_width;
+            }
+            LOOM_ASSERT_LE(log_width, max_log_width);
+            size_t capacity = capacity_;
+            if (size_ == capacity_) {
+                capacity = capacity_ ? 2 * capacity_ : size_t(min_capacity);
+            }
+
+            Queue grown;
+            grown.words_ = PackedWords(capacity >> (6 - log_width));
+            grown.capacity_ = capacity;
+            grown.log_width_ = log_width;
+            for (size_t i = 0; i < size_; ++i) {
+                grown._set(i, (* this)[i]);
+            }
+            grown.size_ = size_;
+            * this = std::move(grown);
+        }
+
+        PackedWords words_;
+        size_t head_;
+        size_t size_;
+        size_t capacity_;
+        size_t log_width_;
     };
 
     typedef uint64_t Key;
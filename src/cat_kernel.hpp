@@ -51,6 +51,11 @@ public:
         cross_cat_(cross_cat),
         partial_diffs_(),
         scores_(),
+        block_diffs_(),
+        block_scores_(),
+        block_groupids_(),
+        dirty_groupids_(),
+        is_dirty_(),
         timer_()
     {
         LOOM_ASSERT_LT(0, config.empty_group_count());
@@ -70,9 +75,18 @@ public:
             const protobuf::Row & row,
             Assignments & assignments);
 
+    // adds a block of rows, equivalently to add_row on each row,
+    // optionally writing packed assignments
+    void add_rows (
+            rng_t & rng,
+            const std::vector<protobuf::Row> & rows,
+            std::vector<protobuf::Assignment> * packed_assignments_out);
+
+    // Diff is ProductValue::Diff or FlatDiff
+    template<class Diff>
     void process_add_task (
             CrossCat::Kind & kind,
-            const ProductValue::Diff & partial_diff,
+            const Diff & partial_diff,
             VectorFloat & scores,
             Groupids & groupids,
             rng_t & rng);
@@ -87,9 +101,10 @@ public:
             const protobuf::Row & row,
             Assignments & assignments);
 
+    template<class Diff>
     void process_remove_task (
             CrossCat::Kind & kind,
-            const ProductValue::Diff & partial_diff,
+            const Diff & partial_diff,
             Groupids & groupids,
             rng_t & rng);
 
@@ -97,9 +112,23 @@ public:
 
 private:
 
+    template<class Diff>
+    size_t _add_diff (
+            CrossCat::Kind & kind,
+            const Diff & partial_diff,
+            VectorFloat & scores,
+            rng_t & rng);
+
+    void _add_block (size_t kindid, size_t row_count, rng_t & rng);
+
     CrossCat & cross_cat_;
     std::vector<ProductValue::Diff> partial_diffs_;
     VectorFloat scores_;
+    std::vector<std::vector<FlatDiff>> block_diffs_;
+    std::vector<VectorFloat> block_scores_;
+    std::vector<uint32_t> block_groupids_;
+    std::vector<uint32_t> dirty_groupids_;
+    std::vector<bool> is_dirty_;
     Timer timer_;
 };
 
@@ -197,11 +226,118 @@ inline void CatKernel::add_row (
     }
 }
 
-inline void CatKernel::process_add_task (
+inline void CatKernel::add_rows (
+        rng_t & rng,
+        const std::vector<protobuf::Row> & rows,
+        std::vector<protobuf::Assignment> * packed_assignments_out)
+{
+    Timer::Scope timer(timer_);
+    const size_t row_count = rows.size();
+    if (block_diffs_.size() < row_count) {
+        block_diffs_.resize(row_count);
+    }
+    for (size_t r = 0; r < row_count; ++r) {
+        cross_cat_.splitter.split(rows[r].diff(), block_diffs_[r]);
+    }
+    if (packed_assignments_out) {
+        packed_assignments_out->resize(row_count);
+        for (size_t r = 0; r < row_count; ++r) {
+            auto & assignment = (*packed_assignments_out)[r];
+            assignment.set_rowid(rows[r].id());
+            assignment.clear_groupids();
+        }
+    }
+
+    const size_t kind_count = cross_cat_.kinds.size();
+    for (size_t i = 0; i < kind_count; ++i) {
+        _add_block(i, row_count, rng);
+        if (packed_assignments_out) {
+            for (size_t r = 0; r < row_count; ++r) {
+                auto & assignment = (*packed_assignments_out)[r];
+                assignment.add_groupids(block_groupids_[r]);
+            }
+        }
+    }
+}
+
+// Scores every row of the block against the groups as they stand,
+// one kind at a time so that the kind's groups stay in cache,
+// then samples rows in order.  A row's assignment changes only its own
+// group (or appends a new one), so later rows need only rescore those
+// dirty groups, plus the clustering prior, to match add_row exactly.
+inline void CatKernel::_add_block (
+        size_t kindid,
+        size_t row_count,
+        rng_t & rng)
+{
+    auto & kind = cross_cat_.kinds[kindid];
+    ProductModel & model = kind.model;
+    auto & mixture = kind.mixture;
+    block_groupids_.resize(row_count);
+
+    // dpd shareds grow with each new value, staling block scores
+    if (not model.features.dpd.empty()) {
+        for (size_t r = 0; r < row_count; ++r) {
+            const auto & partial_diff = block_diffs_[r][kindid];
+            block_groupids_[r] = _add_diff(kind, partial_diff, scores_, rng);
+        }
+        return;
+    }
+
+    const size_t group_count = mixture.clustering.counts().size();
+    if (block_scores_.size() < row_count) {
+        block_scores_.resize(row_count);
+    }
+    for (size_t r = 0; r < row_count; ++r) {
+        auto & scores = block_scores_[r];
+        scores.resize(group_count);
+        distributions::vector_zero(group_count, scores.data());
+        mixture.score_diff_groups(model, block_diffs_[r][kindid], scores, rng);
+    }
+
+    dirty_groupids_.clear();
+    is_dirty_.clear();
+    is_dirty_.resize(group_count, false);
+    for (size_t r = 0; r < row_count; ++r) {
+        const auto & partial_diff = block_diffs_[r][kindid];
+        auto & block_scores = block_scores_[r];
+        for (auto groupid : dirty_groupids_) {
+            block_scores[groupid] =
+                mixture.score_diff_group(model, groupid, partial_diff, rng);
+        }
+
+        model.add_diff(partial_diff, rng);
+        const size_t size = mixture.clustering.counts().size();
+        scores_.resize(size);
+        mixture.clustering.score_value(model.clustering, scores_);
+        distributions::vector_add(
+            group_count,
+            scores_.data(),
+            block_scores.data());
+        for (size_t groupid = group_count; groupid < size; ++groupid) {
+            scores_[groupid] +=
+                mixture.score_diff_group(model, groupid, partial_diff, rng);
+        }
+        size_t groupid = sample_from_scores_overwrite(rng, scores_);
+
+        if (cross_cat_.tares.empty()) {
+            mixture.add_value(model, groupid, partial_diff.pos(), rng);
+        } else {
+            mixture.add_diff(model, groupid, partial_diff, rng);
+        }
+        if (groupid < group_count and not is_dirty_[groupid]) {
+            is_dirty_[groupid] = true;
+            dirty_groupids_.push_back(groupid);
+        }
+        block_groupids_[r] = groupid;
+    }
+}
+
+template<class Diff>
+inline size_t CatKernel::_add_diff (
         CrossCat::Kind & kind,
-        const ProductValue::Diff & partial_diff,
+        const Diff & partial_diff,
         VectorFloat & scores,
-        Groupids & groupids,
         rng_t & rng)
 {
     ProductModel & model = kind.model;
@@ -220,6 +356,19 @@ inline void CatKernel::process_add_task (
         groupid = sample_from_scores_overwrite(rng, scores);
         mixture.add_diff(model, groupid, partial_diff, rng);
     }
+    return groupid;
+}
+
+template<class Diff>
+inline void CatKernel::process_add_task (
+        CrossCat::Kind & kind,
+        const Diff & partial_diff,
+        VectorFloat & scores,
+        Groupids & groupids,
+        rng_t & rng)
+{
+    size_t groupid = _add_diff(kind, partial_diff, scores, rng);
+    auto & mixture = kind.mixture;
     size_t global_groupid = mixture.id_tracker.packed_to_global(groupid);
     groupids.push(global_groupid);
 }
@@ -278,9 +427,10 @@ inline void CatKernel::remove_row (
     }
 }
 
+template<class Diff>
 inline void CatKernel::process_remove_task (
         CrossCat::Kind & kind,
-        const ProductValue::Diff & partial_diff,
+        const Diff & partial_diff,
         Groupids & groupids,
         rng_t & rng)
 {
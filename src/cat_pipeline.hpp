@@ -28,73 +28,20 @@
 
 #pragma once
 
-#include <thread>
-#include <loom/common.hpp>
-#include <loom/cross_cat.hpp>
-#include <loom/assignments.hpp>
-#include <loom/stream_interval.hpp>
 #include <loom/cat_kernel.hpp>
-#include <loom/pipeline.hpp>
+#include <loom/row_pipeline.hpp>
 
 namespace loom
 {
 
-class CatPipeline
-{
-public:
-
-    enum { stage_count = 3 };
-
-    CatPipeline (
-            const protobuf::Config::Kernels::Cat & config,
-            CrossCat & cross_cat,
-            StreamInterval & rows,
-            Assignments & assignments,
-            CatKernel & cat_kernel,
-            rng_t & rng);
-
-    void add_row ()
-    {
-        pipeline_.start([](Task & task){ task.add = true; });
-    }
-
-    void remove_row ()
-    {
-        pipeline_.start([](Task & task){ task.add = false; });
-    }
-
-    void wait () { pipeline_.wait(); }
-
-private:
-
-    struct Task
-    {
-        std::atomic_flag parsed;
-        bool add;
-        std::vector<char> raw;
-        protobuf::Row row;
-        std::vector<ProductValue::Diff> partial_diffs;
-
-        Task () : parsed(ATOMIC_FLAG_INIT) {}
-    };
-
-    struct ThreadState
-    {
-        rng_t rng;
-        VectorFloat scores;
-    };
-
-    template<class Fun>
-    void add_thread (size_t stage_number, const Fun & fun);
+typedef RowPipeline<CatKernel> CatPipeline;
 
-    void start_threads (size_t parser_threads);
+template<>
+void CatPipeline::_process_kind (
+        size_t i,
+        const Task & task,
+        ThreadState & thread);
 
-    Pipeline<Task, ThreadState> pipeline_;
-    CrossCat & cross_cat_;
-    StreamInterval & rows_;
-    Assignments & assignments_;
-    CatKernel & cat_kernel_;
-    rng_t & rng_;
-};
+extern template class RowPipeline<CatKernel>;
 
 } // namespace loom
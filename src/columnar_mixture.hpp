@@ -0,0 +1,450 @@
+// Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+// Copyright (c) 2015, Google, Inc.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// - Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// - Neither the name of Salesforce.com nor the names of its contributors
+//   may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+// OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+// TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <loom/common.hpp>
+#include <loom/product_model.hpp>
+
+#ifdef LOOM_COLUMNAR_MIXTURE
+#include <cmath>
+#include <vector>
+#include <distributions/aligned_allocator.hpp>
+#include <distributions/special.hpp>
+#ifdef LOOM_ASSUME_X86
+#  include <immintrin.h>
+#endif // LOOM_ASSUME_X86
+#endif // LOOM_COLUMNAR_MIXTURE
+
+namespace loom
+{
+
+#ifdef LOOM_COLUMNAR_MIXTURE
+
+//----------------------------------------------------------------------------
+// Columnar score tables
+//
+// ColumnarMixture mirrors the per-group score terms of a FastProductMixture's
+// BB, DD16 and NICH features in a single aligned arena.  Each row holds one
+// term for every group, so scoring a row of data adds one contiguous row per
+// observed BB or DD16 feature, and evaluates one contiguous Student-t per
+// NICH feature, never touching per-group objects.  Other feature types are
+// scored by their own mixtures.
+//
+// Rows are laid out as
+//   BB    2 rows per feature: scores of false, true
+//   DD16  16 rows per feature: scores of each value
+//   NICH  4 rows per feature: score, log_coeff, precision, mean
+// where the NICH score of x in group g is
+//   score[g] + log_coeff[g] * log(1 + precision[g] * (x - mean[g])^2)
+//
+// Tables are rebuilt lazily after invalidate(), on the next update.
+
+class ColumnarMixture
+{
+public:
+
+    enum {
+        alignment = 64,
+        block_size = alignment / sizeof(float),
+        bb_rows = 2,
+        dd16_rows = 16,
+        nich_rows = 4
+    };
+
+    typedef distributions::aligned_allocator<float, alignment> Allocator;
+    typedef std::vector<float, Allocator> Table;
+
+    ColumnarMixture () :
+        valid_(false),
+        group_count_(0),
+        stride_(0),
+        dd16_begin_(0),
+        nich_begin_(0),
+        row_count_(0),
+        table_()
+    {
+    }
+
+    bool valid () const { return valid_; }
+    void invalidate () { valid_ = false; }
+
+    template<class Features>
+    void init (
+            const ProductModel & model,
+            const Features & mixtures,
+            size_t group_count,
+            rng_t & rng)
+    {
+        group_count_ = group_count;
+        stride_ = _round_up(group_count);
+        dd16_begin_ = bb_rows * mixtures.bb.size();
+        nich_begin_ = dd16_begin_ + dd16_rows * mixtures.dd16.size();
+        row_count_ = nich_begin_ + nich_rows * mixtures.nich.size();
+        table_.clear();
+        table_.resize(row_count_ * stride_, 0.f);
+        for (size_t groupid = 0; groupid < group_count; ++groupid) {
+            _update_group(model, mixtures, groupid, rng);
+        }
+        valid_ = true;
+    }
+
+    // called after a value has been added to or removed from a group
+    template<class Features, class Value>
+    void update_value (
+            const ProductModel & model,
+            const Features & mixtures,
+            size_t groupid,
+            const Value & value,
+            rng_t & rng)
+    {
+        update_fun<Features> fun = {*this, model, mixtures, groupid, rng};
+        read_value(fun, model.schema, mixtures, value);
+    }
+
+    // called after an empty group has been appended
+    template<class Features>
+    void add_group (
+            const ProductModel & model,
+            const Features & mixtures,
+            rng_t & rng)
+    {
+        if (LOOM_UNLIKELY(group_count_ == stride_)) {
+            _reshape(_round_up(group_count_ + 1));
+        }
+        _update_group(model, mixtures, group_count_++, rng);
+    }
+
+    // called after a group has been packed-removed
+    void remove_group (size_t groupid)
+    {
+        LOOM_ASSERT1(groupid < group_count_, "bad groupid: " << groupid);
+        const size_t last = --group_count_;
+        float * row = table_.data();
+        for (size_t r = 0; r < row_count_; ++r, row += stride_) {
+            row[groupid] = row[last];
+        }
+    }
+
+    template<class Features, class Value>
+    void score_value (
+            const ProductModel & model,
+            const Features & mixtures,
+            const Value & value,
+            VectorFloat & scores,
+            rng_t & rng) const
+    {
+        if (LOOM_DEBUG_LEVEL >= 1) {
+            LOOM_ASSERT_EQ(scores.size(), group_count_);
+        }
+        score_fun<Features> fun = {*this, model, mixtures, scores, rng};
+        read_value(fun, model.schema, mixtures, value);
+    }
+
+private:
+
+    template<class Features>
+    struct update_fun
+    {
+        ColumnarMixture & columnar;
+        const ProductModel & model;
+        const Features & mixtures;
+        const size_t groupid;
+        rng_t & rng;
+
+        template<class T>
+        void operator() (T * t, size_t i, const typename T::Value &)
+        {
+            columnar._update(model, mixtures, t, i, groupid, rng);
+        }
+    };
+
+    template<class Features>
+    struct update_group_fun
+    {
+        ColumnarMixture & columnar;
+        const ProductModel & model;
+        const Features & mixtures;
+        const size_t groupid;
+        rng_t & rng;
+
+        template<class T>
+        void operator() (T * t)
+        {
+            for (size_t i = 0, size = mixtures[t].size(); i < size; ++i) {
+                columnar._update(model, mixtures, t, i, groupid, rng);
+            }
+        }
+    };
+
+    template<class Features>
+    struct score_fun
+    {
+        const ColumnarMixture & columnar;
+        const ProductModel & model;
+        const Features & mixtures;
+        VectorFloat & scores;
+        rng_t & rng;
+
+        template<class T>
+        void operator() (T * t, size_t i, const typename T::Value & value)
+        {
+            const auto & shared = model.features[t][i];
+            mixtures[t][i].score_value(shared, value, scores, rng);
+        }
+
+        void operator() (BB *, size_t i, const BB::Value & value)
+        {
+            const float * row = columnar._row(bb_rows * i + value);
+            _add(scores.size(), row, scores.data());
+        }
+
+        void operator() (DD16 *, size_t i, const DD16::Value & value)
+        {
+            const size_t r = columnar.dd16_begin_ + dd16_rows * i + value;
+            _add(scores.size(), columnar._row(r), scores.data());
+        }
+
+        void operator() (NICH *, size_t i, const NICH::Value & value)
+        {
+            const size_t r = columnar.nich_begin_ + nich_rows * i;
+            const float * row = columnar._row(r);
+            _score_student_t(
+                scores.size(),
+                value,
+                row,
+                row + columnar.stride_,
+                row + 2 * columnar.stride_,
+                row + 3 * columnar.stride_,
+                scores.data());
+        }
+    };
+
+    static size_t _round_up (size_t size)
+    {
+        return (size + block_size - 1) / block_size * block_size;
+    }
+
+    float * _row (size_t r) { return table_.data() + r * stride_; }
+    const float * _row (size_t r) const { return table_.data() + r * stride_; }
+
+    void _reshape (size_t stride)
+    {
+        Table table(row_count_ * stride, 0.f);
+        for (size_t r = 0; r < row_count_; ++r) {
+            std::copy(
+                table_.data() + r * stride_,
+                table_.data() + r * stride_ + group_count_,
+                table.data() + r * stride);
+        }
+        table_.swap(table);
+        stride_ = stride;
+    }
+
+    template<class Features>
+    void _update_group (
+            const ProductModel & model,
+            const Features & mixtures,
+            size_t groupid,
+            rng_t & rng)
+    {
+        update_group_fun<Features> fun =
+            {*this, model, mixtures, groupid, rng};
+        for_each_feature_type(fun);
+    }
+
+    template<class Features, class T>
+    void _update (
+            const ProductModel &,
+            const Features &,
+            T *,
+            size_t,
+            size_t,
+            rng_t &)
+    {
+    }
+
+    template<class Features>
+    void _update (
+            const ProductModel & model,
+            const Features & mixtures,
+            BB * t,
+            size_t i,
+            size_t groupid,
+            rng_t & rng)
+    {
+        const auto & shared = model.features[t][i];
+        const auto & mixture = mixtures[t][i];
+        for (size_t value = 0; value < bb_rows; ++value) {
+            _row(bb_rows * i + value)[groupid] =
+                mixture.score_value_group(shared, groupid, value, rng);
+        }
+    }
+
+    template<class Features>
+    void _update (
+            const ProductModel & model,
+            const Features & mixtures,
+            DD16 * t,
+            size_t i,
+            size_t groupid,
+            rng_t & rng)
+    {
+        const auto & shared = model.features[t][i];
+        const auto & mixture = mixtures[t][i];
+        const size_t begin = dd16_begin_ + dd16_rows * i;
+        for (int value = 0; value < shared.dim; ++value) {
+            _row(begin + value)[groupid] =
+                mixture.score_value_group(shared, groupid, value, rng);
+        }
+    }
+
+    // posterior predictive of a normal-inverse-chi-squared group
+    // is a Student-t distribution
+    template<class Features>
+    void _update (
+            const ProductModel & model,
+            const Features & mixtures,
+            NICH * t,
+            size_t i,
+            size_t groupid,
+            rng_t &)
+    {
+        const auto & shared = model.features[t][i];
+        const auto & group = mixtures[t][i].groups(groupid);
+        const float count = group.count;
+        const float kappa = shared.kappa + count;
+        const float mu =
+            (shared.kappa * shared.mu + count * group.mean) / kappa;
+        const float nu = shared.nu + count;
+        const float diff = group.mean - shared.mu;
+        const float sigmasq = (
+            shared.nu * shared.sigmasq +
+            group.count_times_variance +
+            count * shared.kappa * diff * diff / kappa) / nu;
+        const float nu_scale = nu * sigmasq * (1.f + kappa) / kappa;
+
+        float * row = _row(nich_begin_ + nich_rows * i);
+        row[groupid] = distributions::fast_lgamma(0.5f * (nu + 1.f))
+                     - distributions::fast_lgamma(0.5f * nu)
+                     - 0.5f * distributions::fast_log(M_PI * nu_scale);
+        row[stride_ + groupid] = -0.5f * (nu + 1.f);
+        row[2 * stride_ + groupid] = 1.f / nu_scale;
+        row[3 * stride_ + groupid] = mu;
+    }
+
+    static void _add (
+            size_t size,
+            const float * __restrict__ row,
+            float * __restrict__ scores)
+    {
+        size_t g = 0;
+#if defined(LOOM_ASSUME_X86) && defined(__AVX512F__)
+        for (; g + 16 <= size; g += 16) {
+            __m512 x = _mm512_loadu_ps(scores + g);
+            __m512 y = _mm512_load_ps(row + g);
+            _mm512_storeu_ps(scores + g, _mm512_add_ps(x, y));
+        }
+#elif defined(LOOM_ASSUME_X86) && defined(__AVX__)
+        for (; g + 8 <= size; g += 8) {
+            __m256 x = _mm256_loadu_ps(scores + g);
+            __m256 y = _mm256_load_ps(row + g);
+            _mm256_storeu_ps(scores + g, _mm256_add_ps(x, y));
+        }
+#endif
+        for (; g < size; ++g) {
+            scores[g] += row[g];
+        }
+    }
+
+    static void _score_student_t (
+            size_t size,
+            float x,
+            const float * __restrict__ score,
+            const float * __restrict__ log_coeff,
+            const float * __restrict__ precision,
+            const float * __restrict__ mean,
+            float * __restrict__ scores)
+    {
+        for (size_t g = 0; g < size; ++g) {
+            const float diff = x - mean[g];
+            scores[g] += score[g] + log_coeff[g] * distributions::fast_log(
+                1.f + precision[g] * diff * diff);
+        }
+    }
+
+    bool valid_;
+    size_t group_count_;
+    size_t stride_;
+    size_t dd16_begin_;
+    size_t nich_begin_;
+    size_t row_count_;
+    Table table_;
+};
+
+#else // LOOM_COLUMNAR_MIXTURE
+
+class ColumnarMixture
+{
+public:
+
+    bool valid () const { return false; }
+    void invalidate () {}
+
+    template<class Features>
+    void init (const ProductModel &, const Features &, size_t, rng_t &) {}
+
+    template<class Features, class Value>
+    void update_value (
+            const ProductModel &,
+            const Features &,
+            size_t,
+            const Value &,
+            rng_t &)
+    {
+    }
+
+    template<class Features>
+    void add_group (const ProductModel &, const Features &, rng_t &) {}
+
+    void remove_group (size_t) {}
+
+    template<class Features, class Value>
+    void score_value (
+            const ProductModel &,
+            const Features &,
+            const Value &,
+            VectorFloat &,
+            rng_t &) const
+    {
+    }
+};
+
+#endif // LOOM_COLUMNAR_MIXTURE
+
+} // namespace loom
@@ -39,11 +39,13 @@ namespace loom
 
 void CrossCat::mixture_init_unobserved (
         size_t empty_group_count,
+        bool incremental_tare_cache,
         rng_t & rng)
 {
     const std::vector<int> counts(empty_group_count, 0);
     for (auto & kind : kinds) {
         kind.mixture.maintaining_cache = true;
+        kind.mixture.incremental_tare_cache = incremental_tare_cache;
         kind.mixture.init_unobserved(kind.model, counts, rng);
     }
 }
@@ -149,6 +151,7 @@ void CrossCat::tares_load (const char * filename, rng_t & rng)
 void CrossCat::mixture_load (
         const char * dirname,
         size_t empty_group_count,
+        bool incremental_tare_cache,
         rng_t & rng)
 {
     const size_t kind_count = kinds.size();
@@ -161,6 +164,7 @@ void CrossCat::mixture_load (
         Kind & kind = kinds[kindid];
         std::string filename = store::get_mixture_path(dirname, kindid);
         kind.mixture.maintaining_cache = true;
+        kind.mixture.incremental_tare_cache = incremental_tare_cache;
         kind.mixture.load_step_1_of_3(
             kind.model,
             filename.c_str(),
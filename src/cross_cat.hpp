@@ -63,10 +63,12 @@ struct CrossCat : noncopyable
 
     void mixture_init_unobserved (
             size_t empty_group_count,
+            bool incremental_tare_cache,
             rng_t & rng);
     void mixture_load (
             const char * dirname,
             size_t empty_group_count,
+            bool incremental_tare_cache,
             rng_t & rng);
     void mixture_dump (
             const char * dirname,
@@ -144,6 +146,9 @@ inline void CrossCat::validate () const
             LOOM_ASSERT_EQ(
                 kinds[k].mixture.maintaining_cache,
                 kinds[0].mixture.maintaining_cache);
+            LOOM_ASSERT_EQ(
+                kinds[k].mixture.incremental_tare_cache,
+                kinds[0].mixture.incremental_tare_cache);
         }
         std::vector<ProductValue> partial_tares;
         for (size_t id = 0; id < tares.size(); ++id) {
@@ -26,7 +26,9 @@
 // TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
 // USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+#include <thread>
 #include <loom/differ.hpp>
+#include <loom/pipeline.hpp>
 
 namespace loom
 {
@@ -52,95 +54,382 @@ inline protobuf::ProductValue::Observed get_full (const ValueSchema & schema)
     }
     return observed;
 }
+inline const ProductValue & get_dense_row (const protobuf::Row & row)
+{
+    LOOM_ASSERT(not row.diff().tares_size(), "row is already sparsified");
+    const auto & value = row.diff().pos();
+    LOOM_ASSERT_EQ(
+        value.observed().sparsity(),
+        ProductValue::Observed::DENSE);
+    return value;
+}
+inline void serialize (const protobuf::Row & row, std::vector<char> & raw)
+{
+    raw.resize(row.ByteSize());
+    row.SerializeWithCachedSizesToArray(
+        reinterpret_cast<uint8_t *>(raw.data()));
+}
 } // anonymous namespace
 
+struct Differ::Task
+{
+    std::vector<protobuf::RawMessage> raw;
+    std::vector<protobuf::Row> rows;
+    std::vector<protobuf::Row> diffs;
+    std::vector<std::vector<char>> serialized;
+    size_t begin;
+    size_t size;
+
+    Task () : begin(0), size(0) {}
+};
+
+struct Differ::ThreadState
+{
+    ProductValue actual;
+};
+
 Differ::Differ (const ValueSchema & schema) :
     schema_(schema),
     blank_(get_blank(schema)),
     full_(get_full(schema)),
-    row_count_(0),
-    booleans_(schema.booleans_size),
-    counts_(schema.counts_size),
-    small_tare_(),
-    dense_tare_()
+    thread_count_(std::max(1U, std::thread::hardware_concurrency())),
+    small_tares_(),
+    dense_tares_()
 {
-    set_tare(blank_);
+    set_tares({blank_});
 }
 
 Differ::Differ (
         const ValueSchema & schema,
-        const ProductValue & tare) :
+        const std::vector<ProductValue> & tares) :
     schema_(schema),
     blank_(get_blank(schema)),
     full_(get_full(schema)),
-    row_count_(0),
-    booleans_(schema.booleans_size),
-    counts_(schema.counts_size),
-    small_tare_(),
-    dense_tare_()
+    thread_count_(std::max(1U, std::thread::hardware_concurrency())),
+    small_tares_(),
+    dense_tares_()
 {
-    set_tare(tare);
+    set_tares(tares);
 }
 
-void Differ::set_tare (const ProductValue & tare)
+void Differ::set_tares (const std::vector<ProductValue> & tares)
 {
-    schema_.validate(tare);
-    small_tare_ = tare;
-    dense_tare_ = tare;
-    schema_.normalize_small(* small_tare_.mutable_observed());
-    schema_.normalize_dense(* dense_tare_.mutable_observed());
+    LOOM_ASSERT(not tares.empty(), "no tares");
+    small_tares_ = tares;
+    dense_tares_ = tares;
+    for (size_t i = 0; i < tares.size(); ++i) {
+        schema_.validate(tares[i]);
+        schema_.normalize_small(* small_tares_[i].mutable_observed());
+        schema_.normalize_dense(* dense_tares_[i].mutable_observed());
+    }
 }
 
-void Differ::add_rows (const char * rows_in)
+void Differ::Summary::add (const ProductValue & value)
+{
+    auto observed = value.observed().dense().begin();
+    {
+        auto fields = value.booleans().begin();
+        for (auto & summary : booleans) {
+            if (*observed++) {
+                summary.add(*fields++);
+            }
+        }
+    }
+    {
+        auto fields = value.counts().begin();
+        for (auto & summary : counts) {
+            if (*observed++) {
+                summary.add(*fields++);
+            }
+        }
+    }
+    // do not sparsify reals
+    ++row_count;
+}
+
+void Differ::Summary::merge (const Summary & other)
+{
+    for (size_t i = 0; i < booleans.size(); ++i) {
+        booleans[i].merge(other.booleans[i]);
+    }
+    for (size_t i = 0; i < counts.size(); ++i) {
+        counts[i].merge(other.counts[i]);
+    }
+    row_count += other.row_count;
+}
+
+inline bool Differ::_read_chunk (
+        protobuf::InFile & rows,
+        size_t & position,
+        Task & task) const
+{
+    if (LOOM_UNLIKELY(task.raw.empty())) {
+        task.raw.resize(chunk_size);
+        task.rows.resize(chunk_size);
+        task.diffs.resize(chunk_size);
+        task.serialized.resize(chunk_size);
+    }
+    task.begin = position;
+    task.size = 0;
+    while (task.size < chunk_size and
+           rows.try_read_stream(task.raw[task.size])) {
+        ++task.size;
+    }
+    position += task.size;
+    return task.size == chunk_size;
+}
+
+// Calls fun(thread, position, row) on each row, in parallel.
+// Each thread sees its rows in stream order.
+template<class Fun>
+void Differ::_for_each_row (const char * rows_in, const Fun & fun) const
 {
     protobuf::InFile rows(rows_in);
-    protobuf::Row row;
-    while (rows.try_read_stream(row)) {
-        LOOM_ASSERT(not row.diff().tares_size(), "row is already sparsified");
-        const auto & value = row.diff().pos();
-        LOOM_ASSERT_EQ(
-            value.observed().sparsity(),
-            ProductValue::Observed::DENSE);
-
-        auto observed = value.observed().dense().begin();
-        {
-            auto fields = value.booleans().begin();
-            for (auto & summary : booleans_) {
-                if (*observed++) {
-                    summary.add(*fields++);
-                }
+    Pipeline<Task, ThreadState> pipeline(queue_capacity, 1);
+    const size_t thread_count = thread_count_;
+    for (size_t i = 0; i < thread_count; ++i) {
+        pipeline.unsafe_add_thread(0, ThreadState(),
+                [i, thread_count, &fun](Task & task, ThreadState &){
+            for (size_t r = i; r < task.size; r += thread_count) {
+                auto & row = task.rows[r];
+                const auto & raw = task.raw[r];
+                row.ParseFromArray(raw.data, raw.size);
+                fun(i, task.begin + r, row);
+            }
+        });
+    }
+    pipeline.validate();
+
+    size_t position = 0;
+    for (bool more = true; more;) {
+        pipeline.start([&](Task & task){
+            more = _read_chunk(rows, position, task);
+        });
+    }
+    pipeline.wait();
+}
+
+void Differ::add_rows (const char * rows_in, size_t tare_count)
+{
+    LOOM_ASSERT_LT(0, tare_count);
+    if (tare_count > 1) {
+        LOOM_ASSERT(
+            protobuf::InFile(rows_in).is_file(),
+            "finding multiple tares requires a file, not a stream");
+    }
+
+    std::vector<std::vector<Summary>> summaries(
+        thread_count_,
+        std::vector<Summary>(1, Summary(schema_)));
+    _for_each_row(rows_in, [&](
+            size_t thread,
+            size_t,
+            const protobuf::Row & row){
+        summaries[thread][0].add(get_dense_row(row));
+    });
+    for (size_t i = 1; i < thread_count_; ++i) {
+        summaries[0][0].merge(summaries[i][0]);
+    }
+    set_tares({_make_tare(summaries[0][0])});
+
+    // Find more tares by k-modes, seeded farthest-first.
+    if (tare_count > 1) {
+        while (small_tares_.size() < tare_count) {
+            if (not _seed_tare(rows_in)) {
+                break;
             }
         }
-        {
-            auto fields = value.counts().begin();
-            for (auto & summary : counts_) {
-                if (*observed++) {
-                    summary.add(*fields++);
-                }
+        for (size_t pass = 0; pass < max_refine_passes; ++pass) {
+            if (not _refine_tares(rows_in)) {
+                break;
             }
         }
-        // do not sparsify reals
-        ++row_count_;
+    }
+}
+
+bool Differ::_seed_tare (const char * rows_in)
+{
+    struct Farthest
+    {
+        size_t distance;
+        size_t position;
+        protobuf::Row row;
+    };
+    std::vector<Farthest> farthests(thread_count_);
+    for (auto & farthest : farthests) {
+        farthest.distance = 0;
+        farthest.position = 0;
+    }
+    _for_each_row(rows_in, [&](
+            size_t thread,
+            size_t position,
+            const protobuf::Row & row){
+        const auto & data = get_dense_row(row);
+        const auto & tare = dense_tares_[_nearest_tare(data)];
+        const size_t distance = _distance(data, tare);
+        auto & farthest = farthests[thread];
+        if (distance > farthest.distance) {
+            farthest.distance = distance;
+            farthest.position = position;
+            farthest.row = row;
+        }
+    });
+
+    // break ties by stream position, independent of thread count
+    const Farthest * farthest = & farthests[0];
+    for (const auto & other : farthests) {
+        if (other.distance > farthest->distance or
+                (other.distance == farthest->distance and
+                 other.position < farthest->position)) {
+            farthest = & other;
+        }
+    }
+    if (farthest->distance == 0) {
+        return false;
     }
 
-    _make_tare();
+    Summary summary(schema_);
+    summary.add(farthest->row.diff().pos());
+    std::vector<ProductValue> tares = small_tares_;
+    tares.push_back(_make_tare(summary));
+    set_tares(tares);
+    return true;
 }
 
-void Differ::_make_tare ()
+bool Differ::_refine_tares (const char * rows_in)
+{
+    const size_t tare_count = small_tares_.size();
+    std::vector<std::vector<Summary>> summaries(
+        thread_count_,
+        std::vector<Summary>(tare_count, Summary(schema_)));
+    _for_each_row(rows_in, [&](
+            size_t thread,
+            size_t,
+            const protobuf::Row & row){
+        const auto & data = get_dense_row(row);
+        summaries[thread][_nearest_tare(data)].add(data);
+    });
+    for (size_t i = 1; i < thread_count_; ++i) {
+        for (size_t t = 0; t < tare_count; ++t) {
+            summaries[0][t].merge(summaries[i][t]);
+        }
+    }
+
+    std::vector<ProductValue> tares = small_tares_;
+    bool changed = false;
+    for (size_t t = 0; t < tare_count; ++t) {
+        const Summary & summary = summaries[0][t];
+        if (summary.row_count) {
+            ProductValue tare = _make_tare(summary);
+            schema_.normalize_small(* tare.mutable_observed());
+            if (not (tare == tares[t])) {
+                tares[t] = tare;
+                changed = true;
+            }
+        }
+    }
+    if (changed) {
+        set_tares(tares);
+    }
+    return changed;
+}
+
+ProductValue Differ::_make_tare (const Summary & summary) const
 {
     ProductValue tare;
     auto & observed = * tare.mutable_observed();
     observed.set_sparsity(ProductValue::Observed::DENSE);
 
-    _make_tare_type(observed, booleans_, * tare.mutable_booleans());
-    _make_tare_type(observed, counts_, * tare.mutable_counts());
+    _make_tare_type(
+        observed,
+        summary.row_count,
+        summary.booleans,
+        * tare.mutable_booleans());
+    _make_tare_type(
+        observed,
+        summary.row_count,
+        summary.counts,
+        * tare.mutable_counts());
 
     size_t ignored = schema_.reals_size;
     for (size_t i = 0; i < ignored; ++i) {
         observed.add_dense(false);
     }
 
-    set_tare(tare);
+    return tare;
+}
+
+inline size_t Differ::_nearest_tare (const ProductValue & data) const
+{
+    const size_t tare_count = dense_tares_.size();
+    if (LOOM_LIKELY(tare_count == 1)) {
+        return 0;
+    }
+    size_t nearest = 0;
+    size_t min_distance = _distance(data, dense_tares_[0]);
+    for (size_t i = 1; i < tare_count; ++i) {
+        const size_t distance = _distance(data, dense_tares_[i]);
+        if (distance < min_distance) {
+            min_distance = distance;
+            nearest = i;
+        }
+    }
+    return nearest;
+}
+
+inline size_t Differ::_distance (
+        const ProductValue & data,
+        const ProductValue & tare) const
+{
+    // reals are never tared, so they are equidistant from all tares
+    size_t distance = 0;
+    BlockIterator block;
+    if (block(schema_.booleans_size)) {
+        distance += _distance_type<bool>(data, tare, block);
+    }
+    if (block(schema_.counts_size)) {
+        distance += _distance_type<uint32_t>(data, tare, block);
+    }
+    return distance;
+}
+
+template<class T>
+inline size_t Differ::_distance_type (
+        const ProductValue & data,
+        const ProductValue & tare,
+        const BlockIterator & block) const
+{
+    // this counts the pos + neg fields of the diff data - tare
+    const size_t begin = block.begin();
+    const size_t end = block.end();
+    auto tare_observed = tare.observed().dense().begin() + begin;
+    const auto tare_observed_end = tare.observed().dense().begin() + end;
+    auto data_observed = data.observed().dense().begin() + begin;
+    auto tare_value = protobuf::Fields<T>::get(tare).begin();
+    auto data_value = protobuf::Fields<T>::get(data).begin();
+
+    size_t distance = 0;
+    while (tare_observed != tare_observed_end) {
+        if (*tare_observed) {
+            if (LOOM_LIKELY(*data_observed)) {
+                if (LOOM_UNLIKELY(*data_value != *tare_value)) {
+                    distance += 2;
+                }
+                ++data_value;
+            } else {
+                distance += 1;
+            }
+            ++tare_value;
+        } else {
+            if (*data_observed) {
+                distance += 1;
+                ++data_value;
+            }
+        }
+        ++tare_observed;
+        ++data_observed;
+    }
+    return distance;
 }
 
 inline void Differ::_compress (ProductValue & data) const
@@ -154,6 +443,8 @@ inline void Differ::_compress (ProductValue::Diff & diff) const
     _compress(* diff.mutable_neg());
 }
 
+// Rows are parsed and diffed by worker threads, then serialized rows
+// are written by a single writer thread in their original order.
 void Differ::compress_rows (
         const char * rows_in,
         const char * diffs_out) const
@@ -165,37 +456,67 @@ void Differ::compress_rows (
             "in-place sparsify is not supported");
     }
     protobuf::OutFile diffs(diffs_out);
-    protobuf::Row abs;
-    protobuf::Row rel;
-    ProductValue actual;
-    if (schema_.total_size(dense_tare_)) {
-        while (rows.try_read_stream(abs)) {
-            rel.set_id(abs.id());
-            ProductValue & data = * abs.mutable_diff()->mutable_pos();
-            ProductValue::Diff & diff = * rel.mutable_diff();
-            _abs_to_rel(data, diff);
-            _compress(* rel.mutable_diff());
-            diffs.write_stream(rel);
-            if (LOOM_DEBUG_LEVEL >= 3) {
-                _rel_to_abs(actual, diff);
-                LOOM_ASSERT_EQ(actual, data);
+    diffs.enable_index();
+    bool has_tares = false;
+    for (const auto & tare : dense_tares_) {
+        has_tares = has_tares or schema_.total_size(tare);
+    }
+
+    Pipeline<Task, ThreadState> pipeline(queue_capacity, 2);
+    const size_t thread_count = thread_count_;
+    for (size_t i = 0; i < thread_count; ++i) {
+        pipeline.unsafe_add_thread(0, ThreadState(),
+                [this, i, thread_count, has_tares]
+                (Task & task, ThreadState & thread){
+            for (size_t r = i; r < task.size; r += thread_count) {
+                protobuf::Row & abs = task.rows[r];
+                const auto & raw = task.raw[r];
+                abs.ParseFromArray(raw.data, raw.size);
+                if (has_tares) {
+                    protobuf::Row & rel = task.diffs[r];
+                    rel.set_id(abs.id());
+                    ProductValue & data = * abs.mutable_diff()->mutable_pos();
+                    ProductValue::Diff & diff = * rel.mutable_diff();
+                    _abs_to_rel(data, diff);
+                    _compress(diff);
+                    serialize(rel, task.serialized[r]);
+                    if (LOOM_DEBUG_LEVEL >= 3) {
+                        _rel_to_abs(thread.actual, diff);
+                        LOOM_ASSERT_EQ(thread.actual, data);
+                    }
+                } else {
+                    _compress(* abs.mutable_diff());
+                    serialize(abs, task.serialized[r]);
+                }
             }
+        });
+    }
+    pipeline.unsafe_add_thread(1, ThreadState(),
+            [&diffs](Task & task, ThreadState &){
+        for (size_t r = 0; r < task.size; ++r) {
+            const std::vector<char> & raw = task.serialized[r];
+            diffs.write_stream(raw);
         }
-    } else {
-        while (rows.try_read_stream(abs)) {
-            _compress(* abs.mutable_diff());
-            diffs.write_stream(abs);
-        }
+    });
+    pipeline.validate();
+
+    size_t position = 0;
+    for (bool more = true; more;) {
+        pipeline.start([&](Task & task){
+            more = _read_chunk(rows, position, task);
+        });
     }
+    pipeline.wait();
 }
 
 template<class Summaries, class Values>
 inline void Differ::_make_tare_type (
         ProductValue::Observed & observed,
+        size_t row_count,
         const Summaries & summaries,
         Values & values) const
 {
-    const float count_threshold = 0.5 * row_count_;
+    const float count_threshold = 0.5 * row_count;
     for (const auto & summary : summaries) {
         const auto mode = summary.get_mode();
         bool is_dense = (summary.get_count(mode) > count_threshold);
@@ -248,6 +569,7 @@ inline void Differ::_clean_temporaries (ProductValue & value) const
 
 template<class T>
 inline void Differ::_abs_to_rel_type (
+        const ProductValue & tare,
         const ProductValue & data,
         ProductValue & pos,
         ProductValue & neg,
@@ -255,14 +577,14 @@ inline void Differ::_abs_to_rel_type (
 {
     const size_t begin = block.begin();
     const size_t end = block.end();
-    auto tare_observed = dense_tare_.observed().dense().begin() + begin;
-    const auto tare_observed_end = dense_tare_.observed().dense().begin() + end;
+    auto tare_observed = tare.observed().dense().begin() + begin;
+    const auto tare_observed_end = tare.observed().dense().begin() + end;
     auto data_observed = data.observed().dense().begin() + begin;
     auto pos_observed =
         pos.mutable_observed()->mutable_dense()->begin() + begin;
     auto neg_observed =
         neg.mutable_observed()->mutable_dense()->begin() + begin;
-    auto tare_value = protobuf::Fields<T>::get(dense_tare_).begin();
+    auto tare_value = protobuf::Fields<T>::get(tare).begin();
     auto data_value = protobuf::Fields<T>::get(data).begin();
     auto & pos_values = protobuf::Fields<T>::get(pos);
     auto & neg_values = protobuf::Fields<T>::get(neg);
@@ -300,6 +622,7 @@ inline void Differ::_abs_to_rel_type (
 
 template<class T>
 inline void Differ::_rel_to_abs_type (
+        const ProductValue & tare,
         ProductValue & data,
         const ProductValue & pos,
         const ProductValue & neg,
@@ -307,13 +630,13 @@ inline void Differ::_rel_to_abs_type (
 {
     const size_t begin = block.begin();
     const size_t end = block.end();
-    auto tare_observed = dense_tare_.observed().dense().begin() + begin;
-    const auto tare_observed_end = dense_tare_.observed().dense().begin() + end;
+    auto tare_observed = tare.observed().dense().begin() + begin;
+    const auto tare_observed_end = tare.observed().dense().begin() + end;
     auto data_observed =
         data.mutable_observed()->mutable_dense()->begin() + begin;
     auto pos_observed = pos.observed().dense().begin() + begin;
     auto neg_observed = neg.observed().dense().begin() + begin;
-    auto tare_value = protobuf::Fields<T>::get(dense_tare_).begin();
+    auto tare_value = protobuf::Fields<T>::get(tare).begin();
     auto & data_values = protobuf::Fields<T>::get(data);
     auto pos_value = protobuf::Fields<T>::get(pos).begin();
 
@@ -339,12 +662,13 @@ inline void Differ::_rel_to_abs_type (
 }
 
 inline void Differ::_validate_diff (
-        const ProductValue & data,
+        const ProductValue & tare_value,
+        const ProductValue & data_value,
         const ProductValue::Diff & diff) const
 {
     if (LOOM_DEBUG_LEVEL >= 3) {
-        const auto & tare_dense = dense_tare_.observed().dense();
-        const auto & data_dense = data.observed().dense();
+        const auto & tare_dense = tare_value.observed().dense();
+        const auto & data_dense = data_value.observed().dense();
         const auto & pos_dense = diff.pos().observed().dense();
         const auto & neg_dense = diff.neg().observed().dense();
         for (size_t i = 0, size = schema_.total_size(); i < size; ++i) {
@@ -371,25 +695,27 @@ inline void Differ::_abs_to_rel (
     ProductValue & neg = * diff.mutable_neg();
 
     _build_temporaries(data);
+    const size_t tareid = _nearest_tare(data);
+    const ProductValue & tare = dense_tares_[tareid];
     pos = blank_;
     neg = blank_;
     diff.clear_tares();
-    diff.add_tares(0);
+    diff.add_tares(tareid);
 
     {
         BlockIterator block;
         if (block(schema_.booleans_size)) {
-            _abs_to_rel_type<bool>(data, pos, neg, block);
+            _abs_to_rel_type<bool>(tare, data, pos, neg, block);
         }
         if (block(schema_.counts_size)) {
-            _abs_to_rel_type<uint32_t>(data, pos, neg, block);
+            _abs_to_rel_type<uint32_t>(tare, data, pos, neg, block);
         }
         if (block(schema_.reals_size)) {
-            _abs_to_rel_type<float>(data, pos, neg, block);
+            _abs_to_rel_type<float>(tare, data, pos, neg, block);
         }
     }
 
-    _validate_diff(data, diff);
+    _validate_diff(tare, data, diff);
     _clean_temporaries(data);
 
     if (LOOM_DEBUG_LEVEL >= 2) {
@@ -412,22 +738,25 @@ inline void Differ::_rel_to_abs (
     data = blank_;
     _build_temporaries(pos);
     _build_temporaries(neg);
-    LOOM_ASSERT1(diff.tares_size(), "diff has no tares");
+    LOOM_ASSERT1(diff.tares_size() == 1, "expected exactly one tare");
+    const size_t tareid = diff.tares(0);
+    LOOM_ASSERT1(tareid < dense_tares_.size(), "bad tare id: " << tareid);
+    const ProductValue & tare = dense_tares_[tareid];
 
     {
         BlockIterator block;
         if (block(schema_.booleans_size)) {
-            _rel_to_abs_type<bool>(data, pos, neg, block);
+            _rel_to_abs_type<bool>(tare, data, pos, neg, block);
         }
         if (block(schema_.counts_size)) {
-            _rel_to_abs_type<uint32_t>(data, pos, neg, block);
+            _rel_to_abs_type<uint32_t>(tare, data, pos, neg, block);
         }
         if (block(schema_.reals_size)) {
-            _rel_to_abs_type<float>(data, pos, neg, block);
+            _rel_to_abs_type<float>(tare, data, pos, neg, block);
         }
     }
 
-    _validate_diff(data, diff);
+    _validate_diff(tare, data, diff);
     _clean_temporaries(pos);
     _clean_temporaries(neg);
 
@@ -40,11 +40,16 @@ class Differ
 public:
 
     Differ (const ValueSchema & schema);
-    Differ (const ValueSchema & schema, const ProductValue & tare);
+    Differ (
+            const ValueSchema & schema,
+            const std::vector<ProductValue> & tares);
 
-    void add_rows (const char * rows_in);
-    const ProductValue & get_tare () const { return small_tare_; }
-    void set_tare (const ProductValue & tare);
+    void add_rows (const char * rows_in, size_t tare_count = 1);
+    const std::vector<ProductValue> & get_tares () const
+    {
+        return small_tares_;
+    }
+    void set_tares (const std::vector<ProductValue> & tares);
 
     void compress_rows (const char * rows_in, const char * diffs_out) const;
 
@@ -57,6 +62,11 @@ private:
 
         BooleanSummary () : counts{0, 0} {}
         void add (Value value) { ++counts[value]; }
+        void merge (const BooleanSummary & other)
+        {
+            counts[0] += other.counts[0];
+            counts[1] += other.counts[1];
+        }
         Value get_mode () const { return counts[1] > counts[0]; }
         size_t get_count (Value value) const { return counts[value]; }
     };
@@ -77,6 +87,13 @@ private:
             }
         }
 
+        void merge (const CountSummary & other)
+        {
+            for (size_t i = 0; i < max_count; ++i) {
+                counts[i] += other.counts[i];
+            }
+        }
+
         Value get_mode () const
         {
             Value value = 0;
@@ -95,19 +112,66 @@ private:
         }
     };
 
-    void _make_tare ();
+    struct Summary
+    {
+        size_t row_count;
+        std::vector<BooleanSummary> booleans;
+        std::vector<CountSummary> counts;
+
+        Summary (const ValueSchema & schema) :
+            row_count(0),
+            booleans(schema.booleans_size),
+            counts(schema.counts_size)
+        {}
+
+        void add (const ProductValue & value);
+        void merge (const Summary & other);
+    };
+
+    // rows are read in chunks that worker threads parse in parallel
+    enum {
+        max_refine_passes = 8,
+        chunk_size = 256,
+        queue_capacity = 8
+    };
+    struct Task;
+    struct ThreadState;
+
+    template<class Fun>
+    void _for_each_row (const char * rows_in, const Fun & fun) const;
+    bool _read_chunk (
+            protobuf::InFile & rows,
+            size_t & position,
+            Task & task) const;
+
+    bool _seed_tare (const char * rows_in);
+    bool _refine_tares (const char * rows_in);
+    ProductValue _make_tare (const Summary & summary) const;
 
     template<class Summaries, class Values>
     void _make_tare_type (
             ProductValue::Observed & observed,
+            size_t row_count,
             const Summaries & summaries,
             Values & values) const;
 
+    size_t _nearest_tare (const ProductValue & data) const;
+    size_t _distance (
+            const ProductValue & data,
+            const ProductValue & tare) const;
+
+    template<class T>
+    size_t _distance_type (
+            const ProductValue & data,
+            const ProductValue & tare,
+            const BlockIterator & block) const;
+
     void _compress (ProductValue & data) const;
     void _compress (ProductValue::Diff & diff) const;
     void _abs_to_rel (ProductValue & data, ProductValue::Diff & diff) const;
     void _rel_to_abs (ProductValue & data, ProductValue::Diff & diff) const;
     void _validate_diff (
+            const ProductValue & tare,
             const ProductValue & data,
             const ProductValue::Diff & diff) const;
     void _build_temporaries (ProductValue & value) const;
@@ -115,6 +179,7 @@ private:
 
     template<class T>
     void _abs_to_rel_type (
+            const ProductValue & tare,
             const ProductValue & abs,
             ProductValue & pos,
             ProductValue & neg,
@@ -122,6 +187,7 @@ private:
 
     template<class T>
     void _rel_to_abs_type (
+            const ProductValue & tare,
             ProductValue & abs,
             const ProductValue & pos,
             const ProductValue & neg,
@@ -130,11 +196,9 @@ private:
     const ValueSchema & schema_;
     const protobuf::ProductValue blank_;
     const protobuf::ProductValue::Observed full_;
-    size_t row_count_;
-    std::vector<BooleanSummary> booleans_;
-    std::vector<CountSummary> counts_;
-    protobuf::ProductValue small_tare_;
-    protobuf::ProductValue dense_tare_;
+    const size_t thread_count_;
+    std::vector<protobuf::ProductValue> small_tares_;
+    std::vector<protobuf::ProductValue> dense_tares_;
 };
 
 } // namespace loom
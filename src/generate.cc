@@ -43,6 +43,7 @@ const char * help_message =
 "\n                or --none to discard assignments"
 "\nNotes:"
 "\n  Any filename can end with .gz to indicate gzip compression."
+"\n  Any stream filename can end with .pbsz to indicate block compression."
 "\n  Any filename can be '-' or '-.gz' to indicate stdin/stdout."
 ;
 
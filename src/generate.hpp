@@ -30,10 +30,123 @@
 #include <loom/hyper_kernel.hpp>
 #include <loom/kind_proposer.hpp>
 #include <loom/infer_grid.hpp>
+#include <loom/pipeline.hpp>
 
 namespace loom
 {
 
+inline void generate_kind_value (
+        CrossCat::Kind & kind,
+        float density,
+        Assignments::Queue<Assignments::Value> & groupids,
+        VectorFloat & scores,
+        ProductValue & value,
+        rng_t & rng)
+{
+    ProductModel & model = kind.model;
+    auto & mixture = kind.mixture;
+
+    scores.resize(mixture.clustering.counts().size());
+    mixture.clustering.score_value(model.clustering, scores);
+    distributions::scores_to_probs(scores);
+    const VectorFloat & probs = scores;
+
+    auto & observed = * value.mutable_observed();
+    ValueSchema::clear(observed);
+    observed.set_sparsity(ProductModel::Value::Observed::DENSE);
+    const size_t feature_count = kind.featureids.size();
+    for (size_t f = 0; f < feature_count; ++f) {
+        observed.add_dense(
+            distributions::sample_bernoulli(rng, density));
+    }
+    size_t groupid = mixture.sample_value(model, probs, value, rng);
+
+    model.add_value(value, rng);
+    mixture.add_value(model, groupid, value, rng);
+    groupids.push(groupid);
+}
+
+// Kinds are independent given the model, so each kind samples its part
+// of each row on its own thread, while a writer thread joins and writes
+// rows in order.  Each kind draws from its own rng, so parallel output
+// differs from sequential output for the same seed.
+inline void generate_rows_parallel (
+        const protobuf::Config::Generate & config,
+        CrossCat & cross_cat,
+        Assignments & assignments,
+        protobuf::OutFile & rows,
+        rng_t & rng)
+{
+    enum { rows_per_task = 64, queue_capacity = 16 };
+
+    struct Task
+    {
+        size_t begin;
+        size_t size;
+        std::vector<std::vector<ProductValue>> partial_values;
+    };
+
+    struct ThreadState
+    {
+        rng_t rng;
+        VectorFloat scores;
+    };
+
+    const size_t kind_count = cross_cat.kinds.size();
+    const size_t row_count = config.row_count();
+    const float density = config.density();
+    protobuf::Row row;
+    cross_cat.schema.clear(* row.mutable_diff());
+
+    Pipeline<Task, ThreadState> pipeline(queue_capacity, 2);
+    for (size_t k = 0; k < kind_count; ++k) {
+        ThreadState init;
+        init.rng.seed(rng());
+        pipeline.unsafe_add_thread(0, init,
+                [k, density, &cross_cat, &assignments]
+                (Task & task, ThreadState & thread){
+            auto & kind = cross_cat.kinds[k];
+            auto & groupids = assignments.groupids(k);
+            for (size_t r = 0; r < task.size; ++r) {
+                generate_kind_value(
+                    kind,
+                    density,
+                    groupids,
+                    thread.scores,
+                    task.partial_values[r][k],
+                    thread.rng);
+            }
+        });
+    }
+    pipeline.unsafe_add_thread(1, ThreadState(),
+            [&cross_cat, &row, &rows](Task & task, ThreadState &){
+        ProductValue & full_value = * row.mutable_diff()->mutable_pos();
+        for (size_t r = 0; r < task.size; ++r) {
+            row.set_id(task.begin + r);
+            cross_cat.splitter.join(full_value, task.partial_values[r]);
+            rows.write_stream(row);
+        }
+    });
+    pipeline.validate();
+
+    for (size_t begin = 0; begin < row_count; begin += rows_per_task) {
+        const size_t end = std::min(begin + rows_per_task, row_count);
+        for (size_t id = begin; id < end; ++id) {
+            assignments.rowids().try_push(id);
+        }
+        pipeline.start([begin, end, kind_count](Task & task){
+            if (LOOM_UNLIKELY(task.partial_values.empty())) {
+                task.partial_values.resize(
+                    rows_per_task,
+                    std::vector<ProductValue>(kind_count));
+            }
+            task.begin = begin;
+            task.size = end - begin;
+        });
+    }
+    pipeline.wait();
+}
+
 void generate_rows (
         const protobuf::Config::Generate & config,
         CrossCat & cross_cat,
@@ -50,41 +163,30 @@ void generate_rows (
     std::vector<ProductModel::Value> partial_values(kind_count);
     protobuf::Row row;
     protobuf::OutFile rows(rows_out);
+    rows.enable_index();
 
     for (auto & kind : cross_cat.kinds) {
         kind.model.realize(rng);
     }
 
+    if (config.parallel()) {
+        generate_rows_parallel(config, cross_cat, assignments, rows, rng);
+        return;
+    }
+
     cross_cat.schema.clear(* row.mutable_diff());
     ProductValue & full_value = * row.mutable_diff()->mutable_pos();
     for (size_t id = 0; id < row_count; ++id) {
         assignments.rowids().try_push(id);
 
         for (size_t k = 0; k < kind_count; ++k) {
-            auto & kind = cross_cat.kinds[k];
-            ProductModel & model = kind.model;
-            auto & mixture = kind.mixture;
-            ProductValue & value = partial_values[k];
-            auto & groupids = assignments.groupids(k);
-
-            scores.resize(mixture.clustering.counts().size());
-            mixture.clustering.score_value(model.clustering, scores);
-            distributions::scores_to_probs(scores);
-            const VectorFloat & probs = scores;
-
-            auto & observed = * value.mutable_observed();
-            ValueSchema::clear(observed);
-            observed.set_sparsity(ProductModel::Value::Observed::DENSE);
-            const size_t feature_count = kind.featureids.size();
-            for (size_t f = 0; f < feature_count; ++f) {
-                observed.add_dense(
-                    distributions::sample_bernoulli(rng, density));
-            }
-            size_t groupid = mixture.sample_value(model, probs, value, rng);
-
-            model.add_value(value, rng);
-            mixture.add_value(model, groupid, value, rng);
-            groupids.push(groupid);
+            generate_kind_value(
+                cross_cat.kinds[k],
+                density,
+                assignments.groupids(k),
+                scores,
+                partial_values[k],
+                rng);
         }
 
         row.set_id(id);
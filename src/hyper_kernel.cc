@@ -191,6 +191,7 @@ inline void HyperKernel::infer_feature_hypers (
     infer_feature_hypers_fun fun = {hyper_prior, mixture.features, rng};
     for_one_feature(fun, model.features, featureid);
     mixture.maintaining_cache = true;
+    mixture.fresh_feature_caches.find(featureid) = true;
 }
 
 void HyperKernel::run (rng_t & rng)
@@ -233,6 +234,21 @@ void HyperKernel::run (rng_t & rng)
                 rng);
         }
     }
+
+    // tare caches depend on the feature hypers updated above
+    if (not cross_cat_.tares.empty()) {
+        #pragma omp parallel for if(parallel_) schedule(dynamic, 1)
+        for (size_t kindid = 0; kindid < kind_count; ++kindid) {
+            rng_t rng(seed + task_count + kindid);
+            auto & kind = cross_cat_.kinds[kindid];
+            kind.mixture.init_tare_cache(kind.model, rng);
+        }
+    }
+
+    for (auto & kind : cross_cat_.kinds) {
+        kind.mixture.columnar.invalidate();
+        kind.mixture.restamp();
+    }
 }
 
 } // namespace loom
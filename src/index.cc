@@ -0,0 +1,69 @@
+// Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+// Copyright (c) 2015, Google, Inc.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// - Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// - Neither the name of Salesforce.com nor the names of its contributors
+//   may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+// OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+// TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <loom/args.hpp>
+#include <loom/protobuf_stream.hpp>
+
+const char * help_message =
+"Usage: index ROWS_IN [STRIDE=1024]"
+"\nArguments:"
+"\n  ROWS_IN       filename of input dataset stream (e.g. rows.pbs.gz)"
+"\n  STRIDE        number of messages between indexed positions"
+"\nNotes:"
+"\n  Writes a sidecar index ROWS_IN.idx for fast seeking."
+"\n  Gzip streams indexed by this tool can only seek by decompressing;"
+"\n  streams written by loom with an index also support random access."
+;
+
+int main (int argc, char ** argv)
+{
+    GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+    Args args(argc, argv, help_message);
+    const char * rows_in = args.pop();
+    const int stride = args.pop_default(
+        static_cast<int>(loom::protobuf::StreamIndex::default_stride));
+    args.done();
+
+    LOOM_ASSERT_LT(0, stride);
+
+    loom::protobuf::InFile rows(rows_in);
+    LOOM_ASSERT(rows.is_file(), "can only index files: " << rows_in);
+    if (rows.is_blocked()) {
+        std::cout << rows_in << " is block-compressed and needs no index\n";
+        return 0;
+    }
+    loom::protobuf::StreamIndex index(stride);
+    loom::protobuf::RawMessage raw;
+    while (rows.try_read_stream(raw)) {
+        index.add_message(raw.size);
+    }
+    index.dump(rows_in);
+
+    return 0;
+}
@@ -57,6 +57,7 @@ const char * help_message =
 "\n                    or --none to not log"
 "\nNotes:"
 "\n  Any filename can end with .gz to indicate gzip compression."
+"\n  Any stream filename can end with .pbsz to indicate block compression."
 "\n  Any filename can be '-' or '-.gz' to indicate stdin/stdout."
 "\n  If running kind inference and GROUPS_IN is provided,"
 "\n    then all data in groups must be accounted for in ASSIGN_IN."
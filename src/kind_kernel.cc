@@ -56,6 +56,8 @@ KindKernel::KindKernel (
     tare_time_(0),
     score_time_(0),
     sample_time_(0),
+    move_time_(0),
+    proposer_memory_bytes_(0),
     timer_()
 {
     Timer::Scope timer(timer_);
@@ -141,6 +143,7 @@ bool KindKernel::try_run ()
     tare_time_ = times.tare;
     score_time_ = times.score;
     sample_time_ = times.sample;
+    proposer_memory_bytes_ = kind_proposer_.memory_bytes();
 
     for (auto & kind : cross_cat_.kinds) {
         kind.mixture.maintaining_cache = false;
@@ -148,8 +151,15 @@ bool KindKernel::try_run ()
     for (auto & kind : kind_proposer_.kinds) {
         kind.mixture.maintaining_cache = false;
     }
-    size_t change_count = move_features(old_kindids, new_kindids);
-    init_featureless_kinds(empty_kind_count_, false);
+    size_t change_count;
+    {
+        move_time_ = 0;
+        TimedScope timer(move_time_);
+
+        // this rebuilds the splitter and tares once for all moves
+        change_count = move_features(old_kindids, new_kindids);
+        init_featureless_kinds(empty_kind_count_, false);
+    }
     kind_proposer_.mixture_init_unobserved(cross_cat_, rng_);
 
     validate();
@@ -159,11 +169,14 @@ bool KindKernel::try_run ()
 
 void KindKernel::add_featureless_kind (bool maintaining_cache)
 {
+    const bool incremental_tare_cache =
+        cross_cat_.kinds[0].mixture.incremental_tare_cache;
     auto & kind = cross_cat_.kinds.packed_add();
     auto & model = kind.model;
     auto & mixture = kind.mixture;
     model.clear();
     mixture.maintaining_cache = maintaining_cache;
+    mixture.incremental_tare_cache = incremental_tare_cache;
 
     const auto & grid_prior = cross_cat_.hyper_prior.clustering();
     if (grid_prior.size()) {
@@ -245,14 +258,8 @@ void KindKernel::move_feature_to_kind (
 
     old_kind.featureids.erase(featureid);
     new_kind.featureids.insert(featureid);
+    new_kind.mixture.restamp();
     cross_cat_.featureid_to_kindid[featureid] = new_kindid;
-
-    // TODO do this less frequently:
-    cross_cat_.update_splitter();
-    cross_cat_.update_tares(temp_values_, rng_);
-
-    cross_cat_.validate();
-    assignments_.validate();
 }
 
 void KindKernel::init_cache ()
@@ -264,15 +271,22 @@ void KindKernel::init_cache ()
     const size_t kind_count = cross_cat_.kinds.size();
     const size_t feature_count = cross_cat_.featureid_to_kindid.size();
 
-    bool hyper_kernel_has_already_initialized_mixtures =
-        cross_cat_.kinds[0].mixture.maintaining_cache;
-
     for (size_t kindid = 0; kindid < kind_count; ++kindid) {
         cross_cat_.kinds[kindid].mixture.maintaining_cache = true;
         kind_proposer_.kinds[kindid].mixture.maintaining_cache = true;
     }
 
-    if (not hyper_kernel_has_already_initialized_mixtures) {
+    // only rebuild caches of moved features and of fresh proposer kinds;
+    // the hyper kernel has already rebuilt caches of features it updated
+    std::vector<uint8_t> rebuilt(kind_count, false);
+    for (size_t featureid = 0; featureid < feature_count; ++featureid) {
+        size_t kindid = cross_cat_.featureid_to_kindid[featureid];
+        const auto & mixture = cross_cat_.kinds[kindid].mixture;
+        if (not mixture.fresh_feature_caches.find(featureid)) {
+            rebuilt[kindid] = true;
+        }
+    }
+    {
         const size_t task_count = feature_count + feature_count;
         const auto seed = rng_();
 
@@ -283,12 +297,18 @@ void KindKernel::init_cache ()
                 size_t featureid = taskid;
                 size_t kindid = cross_cat_.featureid_to_kindid[featureid];
                 auto & kind = cross_cat_.kinds[kindid];
-                kind.mixture.init_feature_cache(kind.model, featureid, rng);
+                auto & mixture = kind.mixture;
+                if (not mixture.fresh_feature_caches.find(featureid)) {
+                    mixture.init_feature_cache(kind.model, featureid, rng);
+                }
             } else {
                 size_t featureid = taskid - feature_count;
                 size_t kindid = cross_cat_.featureid_to_kindid[featureid];
                 auto & kind = kind_proposer_.kinds[kindid];
-                kind.mixture.init_feature_cache(kind.model, featureid, rng);
+                if (not kind.mixture.fresh_feature_caches.find(featureid)) {
+                    const auto & model = kind_proposer_.model;
+                    kind.mixture.init_feature_cache(model, featureid, rng);
+                }
             }
         }
     }
@@ -303,15 +323,27 @@ void KindKernel::init_cache ()
             if (taskid < kind_count) {
                 size_t kindid = taskid;
                 auto & kind = cross_cat_.kinds[kindid];
-                kind.mixture.init_tare_cache(kind.model, rng);
+                if (not kind.mixture.fresh_tare_caches) {
+                    kind.mixture.init_tare_cache(kind.model, rng);
+                }
             } else {
                 size_t kindid = taskid - kind_count;
                 auto & kind = kind_proposer_.kinds[kindid];
-                kind.mixture.init_tare_cache(kind.model, rng);
+                if (not kind.mixture.fresh_tare_caches) {
+                    const auto & model = kind_proposer_.model;
+                    kind.mixture.init_tare_cache(model, rng);
+                }
             }
         }
     }
 
+    // init_tare_cache restamps, but init_feature_cache cannot
+    for (size_t kindid = 0; kindid < kind_count; ++kindid) {
+        if (rebuilt[kindid]) {
+            cross_cat_.kinds[kindid].mixture.restamp();
+        }
+    }
+
     validate();
 }
 
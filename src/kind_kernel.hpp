@@ -58,9 +58,11 @@ public:
     void validate () const;
     void log_metrics (Logger::Message & message);
 
+    // Diff is ProductValue::Diff or FlatDiff
+    template<class Diff>
     size_t add_to_cross_cat (
             size_t kindid,
-            const ProductValue::Diff & partial_diff,
+            const Diff & partial_diff,
             VectorFloat & scores,
             rng_t & rng);
 
@@ -70,9 +72,10 @@ public:
             const ProductValue::Diff & diff,
             rng_t & rng);
 
+    template<class Diff>
     size_t remove_from_cross_cat (
             size_t kindid,
-            const ProductValue::Diff & partial_diff,
+            const Diff & partial_diff,
             rng_t & rng);
 
     void remove_from_kind_proposer (
@@ -90,6 +93,7 @@ private:
             const std::vector<uint32_t> & old_kindids,
             const std::vector<uint32_t> & new_kindids);
 
+    // callers must update splitter and tares after moving features
     void move_feature_to_kind (
             size_t featureid,
             size_t new_kindid);
@@ -114,6 +118,8 @@ private:
     usec_t tare_time_;
     usec_t score_time_;
     usec_t sample_time_;
+    usec_t move_time_;
+    size_t proposer_memory_bytes_;
     Timer timer_;
 };
 
@@ -138,6 +144,8 @@ inline void KindKernel::log_metrics (Logger::Message & message)
     status.set_tare_time(tare_time_);
     status.set_score_time(score_time_);
     status.set_sample_time(sample_time_);
+    status.set_move_time(move_time_);
+    status.set_proposer_memory_bytes(proposer_memory_bytes_);
     status.set_total_time(timer_.total());
     timer_.clear();
 }
@@ -162,9 +170,10 @@ inline void KindKernel::add_row (const protobuf::Row & row)
     }
 }
 
+template<class Diff>
 inline size_t KindKernel::add_to_cross_cat (
         size_t kindid,
-        const ProductValue::Diff & partial_diff,
+        const Diff & partial_diff,
         VectorFloat & scores,
         rng_t & rng)
 {
@@ -198,16 +207,17 @@ inline void KindKernel::add_to_kind_proposer (
         rng_t & rng)
 {
     LOOM_ASSERT3(kindid < cross_cat_.kinds.size(), "bad kindid: " << kindid);
-    auto & kind = kind_proposer_.kinds[kindid];
-    ProductModel & model = kind.model;
-    auto & mixture = kind.mixture;
+    const ProductModel & model = kind_proposer_.model;
+    auto & mixture = kind_proposer_.kinds[kindid].mixture;
+
+    if (kindid == 0) {
+        kind_proposer_.mark_observed(diff);
+    }
 
     if (cross_cat_.tares.empty()) {
         auto & value = diff.pos();
-        model.add_value(value, rng);
         mixture.add_value(model, groupid, value, rng);
     } else {
-        model.add_diff(diff, rng);
 //#define DEBUG_LAZY_ADD_DIFF
 #ifdef DEBUG_LAZY_ADD_DIFF
         mixture.add_diff(model, groupid, diff, rng);
@@ -236,9 +246,10 @@ inline void KindKernel::remove_row (const protobuf::Row & row)
     }
 }
 
+template<class Diff>
 inline size_t KindKernel::remove_from_cross_cat (
         size_t kindid,
-        const ProductValue::Diff & partial_diff,
+        const Diff & partial_diff,
         rng_t & rng)
 {
     LOOM_ASSERT3(kindid < cross_cat_.kinds.size(), "bad kindid: " << kindid);
@@ -264,9 +275,8 @@ inline void KindKernel::remove_from_kind_proposer (
         size_t groupid)
 {
     LOOM_ASSERT3(kindid < cross_cat_.kinds.size(), "bad kindid: " << kindid);
-    auto & kind = kind_proposer_.kinds[kindid];
-    ProductModel & model = kind.model;
-    auto & mixture = kind.mixture;
+    const ProductModel & model = kind_proposer_.model;
+    auto & mixture = kind_proposer_.kinds[kindid].mixture;
 
     mixture.remove_unobserved_value(model, groupid);
 }
@@ -28,98 +28,62 @@
 
 #pragma once
 
-#include <thread>
-#include <loom/common.hpp>
-#include <loom/cross_cat.hpp>
-#include <loom/assignments.hpp>
-#include <loom/stream_interval.hpp>
 #include <loom/kind_kernel.hpp>
-#include <loom/pipeline.hpp>
+#include <loom/row_pipeline.hpp>
 
 namespace loom
 {
 
-class KindPipeline
+template<>
+void RowPipeline<KindKernel>::_process_kind (
+        size_t i,
+        const Task & task,
+        ThreadState & thread);
+
+extern template class RowPipeline<KindKernel>;
+
+class KindPipeline : public RowPipeline<KindKernel>
 {
 public:
 
-    enum { stage_count = 3 };
-
     KindPipeline (
             const protobuf::Config::Kernels::Kind & config,
             CrossCat & cross_cat,
             StreamInterval & rows,
             Assignments & assignments,
             KindKernel & kind_kernel,
-            rng_t & rng);
-
-    void add_row ()
-    {
-        pipeline_.start([](Task & task){ task.add = true; });
-    }
-
-    void remove_row ()
-    {
-        pipeline_.start([](Task & task){ task.add = false; });
-    }
-
-    void wait ()
+            rng_t & rng) :
+        RowPipeline(config, cross_cat, rows, assignments, kind_kernel, rng)
     {
-        pipeline_.wait();
     }
 
     bool try_run ()
     {
-        bool changed = kind_kernel_.try_run();
+        bool changed = kernel_.try_run();
         if (changed) {
-            start_kind_threads();
-            pipeline_.validate();
+            if (balancer_.worker_count()) {
+                balancer_.invalidate();
+                _rebalance();
+            } else {
+                stop_dead_kind_threads();
+                start_kind_threads();
+                pipeline_.validate();
+            }
         }
         return changed;
     }
 
     void init_cache ()
     {
-        kind_kernel_.init_cache();
+        kernel_.init_cache();
+        rehome();
     }
 
     void log_metrics (Logger::Message & message)
     {
-        kind_kernel_.log_metrics(message);
+        kernel_.log_metrics(message);
+        RowPipeline::log_metrics(message);
     }
-
-private:
-
-    struct Task
-    {
-        std::atomic_flag parsed;
-        bool add;
-        std::vector<char> raw;
-        protobuf::Row row;
-        std::vector<ProductValue::Diff> partial_diffs;
-
-        Task () : parsed(ATOMIC_FLAG_INIT) {}
-    };
-
-    struct ThreadState
-    {
-        rng_t rng;
-        VectorFloat scores;
-    };
-
-    template<class Fun>
-    void add_thread (size_t stage_number, const Fun & fun);
-
-    void start_threads (size_t parser_threads);
-    void start_kind_threads ();
-
-    Pipeline<Task, ThreadState> pipeline_;
-    CrossCat & cross_cat_;
-    StreamInterval & rows_;
-    Assignments & assignments_;
-    KindKernel & kind_kernel_;
-    size_t kind_count_;
-    rng_t & rng_;
 };
 
 } // namespace loom
@@ -26,10 +26,9 @@
 // TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
 // USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
-#include <unordered_set>
+#include <algorithm>
 #include <distributions/random.hpp>
 #include <distributions/vector_math.hpp>
-#include <distributions/trivial_hash.hpp>
 #include <loom/kind_proposer.hpp>
 
 #define LOOM_ASSERT_CLOSE(x, y) \
@@ -52,13 +51,7 @@ void KindProposer::model_load (
 
 void KindProposer::model_load (const CrossCat & cross_cat)
 {
-    if (const size_t kind_count = kinds.size()) {
-        auto & model = kinds[0].model;
-        model_load(cross_cat, model);
-        for (size_t i = 1; i < kind_count; ++i) {
-            kinds[i].model = model;
-        }
-    }
+    model_load(cross_cat, model);
 }
 
 void KindProposer::mixture_init_unobserved (
@@ -72,11 +65,15 @@ void KindProposer::mixture_init_unobserved (
     for (size_t i = 0; i < kind_count; ++i) {
         kinds[i].mixture.maintaining_cache =
             cross_cat.kinds[i].mixture.maintaining_cache;
+        kinds[i].mixture.incremental_tare_cache =
+            cross_cat.kinds[i].mixture.incremental_tare_cache;
         kinds[i].mixture.init_unobserved(
-            kinds[i].model,
+            model,
             cross_cat.kinds[i].mixture.clustering.counts(),
             rng);
     }
+    observed_featureids_.assign(cross_cat.featureid_to_kindid.size(), 0);
+    observed_tareids_.assign(cross_cat.tares.size(), 0);
 }
 
 //----------------------------------------------------------------------------
@@ -97,22 +94,21 @@ public:
 
     void run (size_t iterations, rng_t & rng);
 
-    typedef std::unordered_set<uint32_t, distributions::TrivialHash<uint32_t>>
-        IdSet;
-
 private:
 
     void validate () const;
 
     float get_likelihood_empty () const;
     std::vector<uint32_t> get_counts_from_assignments () const;
-    IdSet get_empty_kinds_from_counts () const;
+    VectorFloat get_empty_mask_from_counts () const;
     VectorFloat get_prior_from_counts () const;
     void add_empty_kind (size_t kindid);
     void remove_empty_kind (size_t kindid);
 
     static float compute_posterior (
             const VectorFloat & prior_in,
+            const VectorFloat & empty_mask_in,
+            float likelihood_empty,
             const VectorFloat & likelihood_in,
             VectorFloat & posterior_out);
 
@@ -123,12 +119,17 @@ private:
     const std::vector<VectorFloat> & likelihoods_;
     std::vector<uint32_t> & assignments_;
     std::vector<uint32_t> counts_;
-    IdSet empty_kinds_;
+    VectorFloat empty_mask_;
     size_t empty_kind_count_;
+    float likelihood_empty_;
     VectorFloat prior_;
     VectorFloat posterior_;
 };
 
+// Empty kinds share a single prior value, so rather than rewriting each
+// empty kind's prior, we mark empty kinds with 1 in a flat mask and give
+// them 0 in prior_; the posterior kernel then adds back the shared value.
+
 KindProposer::BlockPitmanYorSampler::BlockPitmanYorSampler (
         const distributions::Clustering<int>::PitmanYor & topology,
         const std::vector<VectorFloat> & likelihoods,
@@ -140,8 +141,10 @@ KindProposer::BlockPitmanYorSampler::BlockPitmanYorSampler (
     likelihoods_(likelihoods),
     assignments_(assignments),
     counts_(get_counts_from_assignments()),
-    empty_kinds_(get_empty_kinds_from_counts()),
-    empty_kind_count_(empty_kinds_.size()),
+    empty_mask_(get_empty_mask_from_counts()),
+    empty_kind_count_(
+        std::count(counts_.begin(), counts_.end(), 0U)),
+    likelihood_empty_(get_likelihood_empty()),
     prior_(get_prior_from_counts()),
     posterior_(kind_count_)
 {
@@ -168,28 +171,25 @@ inline std::vector<uint32_t>
     return counts;
 }
 
-inline KindProposer::BlockPitmanYorSampler::IdSet
-    KindProposer::BlockPitmanYorSampler::get_empty_kinds_from_counts () const
+inline VectorFloat
+    KindProposer::BlockPitmanYorSampler::get_empty_mask_from_counts () const
 {
-    IdSet empty_kinds;
+    VectorFloat empty_mask(kind_count_);
     for (size_t k = 0; k < kind_count_; ++k) {
-        if (counts_[k] == 0) {
-            empty_kinds.insert(k);
-        }
+        empty_mask[k] = counts_[k] ? 0.f : 1.f;
     }
-    return empty_kinds;
+    return empty_mask;
 }
 
 inline VectorFloat
     KindProposer::BlockPitmanYorSampler::get_prior_from_counts () const
 {
     VectorFloat prior(kind_count_);
-    const float likelihood_empty = get_likelihood_empty();
     for (size_t k = 0; k < kind_count_; ++k) {
         if (auto count = counts_[k]) {
             prior[k] = count - d_;
         } else {
-            prior[k] = likelihood_empty;
+            prior[k] = 0.f;
         }
     }
     return prior;
@@ -202,12 +202,15 @@ inline void KindProposer::BlockPitmanYorSampler::validate () const
         LOOM_ASSERT_EQ(counts_[k], expected_counts[k]);
     }
 
-    LOOM_ASSERT_EQ(empty_kind_count_, empty_kinds_.size());
+    size_t expected_empty_kind_count = 0;
     for (size_t k = 0; k < kind_count_; ++k) {
-        bool in_empty_kinds = (empty_kinds_.find(k) != empty_kinds_.end());
+        bool in_empty_kinds = (empty_mask_[k] != 0);
         bool has_zero_count = (counts_[k] == 0);
         LOOM_ASSERT_EQ(in_empty_kinds, has_zero_count);
+        expected_empty_kind_count += has_zero_count;
     }
+    LOOM_ASSERT_EQ(empty_kind_count_, expected_empty_kind_count);
+    LOOM_ASSERT_CLOSE(likelihood_empty_, get_likelihood_empty());
 
     VectorFloat expected_prior = get_prior_from_counts();
     for (size_t k = 0; k < kind_count_; ++k) {
@@ -227,32 +230,31 @@ inline float KindProposer::BlockPitmanYorSampler::get_likelihood_empty () const
 
 inline void KindProposer::BlockPitmanYorSampler::add_empty_kind (size_t kindid)
 {
-    empty_kinds_.insert(kindid);
+    empty_mask_[kindid] = 1.f;
+    prior_[kindid] = 0.f;
     ++empty_kind_count_;
-    const float likelihood_empty = get_likelihood_empty();
-    for (auto k : empty_kinds_) {
-        prior_[k] = likelihood_empty;
-    }
+    likelihood_empty_ = get_likelihood_empty();
 }
 
 inline void KindProposer::BlockPitmanYorSampler::remove_empty_kind (size_t kindid)
 {
-    empty_kinds_.erase(kindid);
+    empty_mask_[kindid] = 0.f;
     --empty_kind_count_;
-    const float likelihood_empty = get_likelihood_empty();
-    for (auto k : empty_kinds_) {
-        prior_[k] = likelihood_empty;
-    }
+    likelihood_empty_ = get_likelihood_empty();
 }
 
 inline float KindProposer::BlockPitmanYorSampler::compute_posterior (
         const VectorFloat & prior_in,
+        const VectorFloat & empty_mask_in,
+        float likelihood_empty,
         const VectorFloat & likelihood_in,
         VectorFloat & posterior_out)
 {
     const size_t size = prior_in.size();
     const float * __restrict__ prior =
         DIST_ASSUME_ALIGNED(prior_in.data());
+    const float * __restrict__ empty_mask =
+        DIST_ASSUME_ALIGNED(empty_mask_in.data());
     const float * __restrict__ likelihood =
         DIST_ASSUME_ALIGNED(likelihood_in.data());
     float * __restrict__ posterior =
@@ -260,7 +262,8 @@ inline float KindProposer::BlockPitmanYorSampler::compute_posterior (
 
     float total = 0;
     for (size_t i = 0; i < size; ++i) {
-        total += posterior[i] = prior[i] * likelihood[i];
+        float p = prior[i] + empty_mask[i] * likelihood_empty;
+        total += posterior[i] = p * likelihood[i];
     }
     return total;
 }
@@ -284,7 +287,12 @@ void KindProposer::BlockPitmanYorSampler::run (
             }
 
             const VectorFloat & likelihood = likelihoods_[f];
-            float total = compute_posterior(prior_, likelihood, posterior_);
+            float total = compute_posterior(
+                prior_,
+                empty_mask_,
+                likelihood_empty_,
+                likelihood,
+                posterior_);
             k = sample_from_likelihoods(rng, posterior_, total);
             assignments_[f] = k;
 
@@ -309,13 +317,13 @@ KindProposer::Timers KindProposer::infer_assignments (
 {
     LOOM_ASSERT_LT(0, iterations);
 
-    ProductModel model;
     model_load(cross_cat, model);
     const auto seed = rng();
     const size_t feature_count = featureid_to_kindid.size();
     const size_t kind_count = kinds.size();
-    std::vector<VectorFloat> likelihoods(feature_count);
-    for (auto & likelihood : likelihoods) {
+    LOOM_ASSERT_EQ(observed_featureids_.size(), feature_count);
+    likelihoods_.resize(feature_count);
+    for (auto & likelihood : likelihoods_) {
         likelihood.resize(kind_count);
     }
 
@@ -328,6 +336,13 @@ KindProposer::Timers KindProposer::infer_assignments (
         for (size_t k = 0; k < kind_count; ++k) {
             kinds[k].mixture.add_diff_step_2_of_2(model, rng);
         }
+
+        mark_observed_fun fun = {model.features, observed_featureids_};
+        for (size_t i = 0, size = model.tares.size(); i < size; ++i) {
+            if (observed_tareids_[i]) {
+                read_value(fun, model.schema, model.features, model.tares[i]);
+            }
+        }
     }
     if (LOOM_DEBUG_LEVEL >= 3) {
         for (size_t k = 0; k < kind_count; ++k) {
@@ -340,12 +355,23 @@ KindProposer::Timers KindProposer::infer_assignments (
         #pragma omp parallel for if(parallel) schedule(dynamic, 1)
         for (size_t f = 0; f < feature_count; ++f) {
             rng_t rng(seed + f);
-            VectorFloat & scores = likelihoods[f];
-            for (size_t k = 0; k < kind_count; ++k) {
-                const auto & mixture = kinds[k].mixture;
-                scores[k] = mixture.score_feature(model, f, rng);
+            VectorFloat & scores = likelihoods_[f];
+            if (observed_featureids_[f]) {
+                for (size_t k = 0; k < kind_count; ++k) {
+                    const auto & mixture = kinds[k].mixture;
+                    scores[k] = mixture.score_feature(model, f, rng);
+                }
+                distributions::scores_to_likelihoods(scores);
+            } else {
+                if (LOOM_DEBUG_LEVEL >= 3) {
+                    for (size_t k = 0; k < kind_count; ++k) {
+                        const auto & mixture = kinds[k].mixture;
+                        float score = mixture.score_feature(model, f, rng);
+                        LOOM_ASSERT_LT(fabs(score), 1e-4);
+                    }
+                }
+                std::fill(scores.begin(), scores.end(), 1.f);
             }
-            distributions::scores_to_likelihoods(scores);
         }
     }
     {
@@ -353,7 +379,7 @@ KindProposer::Timers KindProposer::infer_assignments (
 
         BlockPitmanYorSampler sampler(
                 cross_cat.topology,
-                likelihoods,
+                likelihoods_,
                 featureid_to_kindid);
 
         sampler.run(iterations, rng);
@@ -41,13 +41,20 @@ struct KindProposer
 {
     struct Kind
     {
-        ProductModel model;
         SmallProductMixture mixture;
     };
 
+    // All kinds share one model over all features.  It is read-only while
+    // rows are added, so that kinds can be updated in parallel; feature
+    // statistics are reloaded from the cross cat before each inference.
+    ProductModel model;
     std::vector<Kind> kinds;
 
-    void clear () { kinds.clear(); }
+    void clear ()
+    {
+        model.clear();
+        kinds.clear();
+    }
 
     void model_load (const CrossCat & cross_cat);
 
@@ -55,6 +62,10 @@ struct KindProposer
             const CrossCat & cross_cat,
             rng_t & rng);
 
+    // Since every row is added to every kind, it suffices to mark each row
+    // once; callers mark rows while adding to kind 0.
+    void mark_observed (const ProductValue::Diff & diff);
+
     struct Timers { usec_t tare, score, sample; };
 
     Timers infer_assignments (
@@ -65,6 +76,7 @@ struct KindProposer
             rng_t & rng);
 
     void validate (const CrossCat & cross_cat) const;
+    size_t memory_bytes () const;
 
 private:
 
@@ -72,16 +84,53 @@ private:
             const CrossCat & cross_cat,
             ProductModel & model);
 
+    struct mark_observed_fun;
+    struct shared_bytes_fun;
+    struct group_bytes_fun;
     class BlockPitmanYorSampler;
+
+    // Features unobserved since mixture_init_unobserved have empty groups
+    // in every kind and hence score zero, so only observed features are
+    // rescored.
+    std::vector<uint8_t> observed_featureids_;
+    std::vector<uint8_t> observed_tareids_;
+    std::vector<VectorFloat> likelihoods_;
+};
+
+struct KindProposer::mark_observed_fun
+{
+    const ProductModel::Features & shareds;
+    std::vector<uint8_t> & observed_featureids;
+
+    template<class T>
+    void operator() (
+            T * t,
+            size_t i,
+            const typename T::Value &)
+    {
+        observed_featureids[shareds[t].index(i)] = 1;
+    }
 };
 
+inline void KindProposer::mark_observed (const ProductValue::Diff & diff)
+{
+    mark_observed_fun fun = {model.features, observed_featureids_};
+    read_value(fun, model.schema, model.features, diff.pos());
+    read_value(fun, model.schema, model.features, diff.neg());
+    for (auto id : diff.tares()) {
+        observed_tareids_[id] = 1;
+    }
+}
+
 inline void KindProposer::validate (const CrossCat & cross_cat) const
 {
     if (LOOM_DEBUG_LEVEL >= 1) {
         LOOM_ASSERT_EQ(kinds.size(), cross_cat.kinds.size());
+        LOOM_ASSERT_EQ(model.schema, cross_cat.schema);
+        ProductModel current_model;
+        model_load(cross_cat, current_model);
         for (const auto & kind : kinds) {
-            LOOM_ASSERT_EQ(kind.model.schema, cross_cat.schema);
-            kind.mixture.validate(kind.model);
+            kind.mixture.validate(current_model);
         }
         for (size_t i = 0; i < kinds.size(); ++i) {
             size_t proposer_group_count =
@@ -93,4 +142,56 @@ inline void KindProposer::validate (const CrossCat & cross_cat) const
     }
 }
 
+struct KindProposer::shared_bytes_fun
+{
+    size_t bytes;
+
+    template<class T>
+    void operator() (T *, size_t, const typename T::Shared &)
+    {
+        bytes += sizeof(typename T::Shared);
+    }
+};
+
+struct KindProposer::group_bytes_fun
+{
+    size_t bytes;
+
+    template<class T, class Mixture>
+    void operator() (T *, size_t, const Mixture & mixture)
+    {
+        bytes += sizeof(Mixture);
+        bytes += mixture.groups().capacity() * sizeof(typename T::Group);
+    }
+};
+
+// This counts the shared model, every kind's per-feature group statistics
+// and group counts, and scoring buffers.  It is a lower bound, since heap
+// storage owned by individual shareds and groups, e.g. the sparse value
+// counts of dpd features, is not visible here.
+inline size_t KindProposer::memory_bytes () const
+{
+    shared_bytes_fun shared_fun = {0};
+    for_each_feature(shared_fun, model.features);
+    size_t bytes = shared_fun.bytes;
+
+    group_bytes_fun group_fun = {0};
+    for (const auto & kind : kinds) {
+        const auto & mixture = kind.mixture;
+        for_each_feature(group_fun, mixture.features);
+        const auto & counts = mixture.clustering.counts();
+        bytes += counts.capacity() * sizeof(counts[0]);
+        for (const auto & tare_cache : mixture.tare_caches) {
+            bytes += tare_cache.counts.capacity() * sizeof(uint32_t);
+        }
+    }
+    bytes += group_fun.bytes + kinds.capacity() * sizeof(Kind);
+
+    bytes += observed_featureids_.capacity() + observed_tareids_.capacity();
+    for (const auto & likelihoods : likelihoods_) {
+        bytes += likelihoods.capacity() * sizeof(float);
+    }
+    return bytes;
+}
+
 } // namespace loom
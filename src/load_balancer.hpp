@@ -0,0 +1,160 @@
+// Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+// Copyright (c) 2015, Google, Inc.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// - Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// - Neither the name of Salesforce.com nor the names of its contributors
+//   may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+// OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+// TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <loom/common.hpp>
+#include <loom/timer.hpp>
+
+namespace loom
+{
+
+// LoadBalancer packs a set of independent tasks (e.g. kinds) onto a fixed
+// number of workers, using longest-processing-time-first scheduling on
+// per-task costs measured by the workers themselves.
+//
+// Workers may only touch their own Worker struct, and only while the
+// balancer is not being modified, i.e. between pipeline barriers.
+
+class LoadBalancer : noncopyable
+{
+public:
+
+    struct Worker
+    {
+        std::vector<size_t> taskids;
+        std::vector<usec_t> times;
+        usec_t total_time;
+
+        Worker () : taskids(), times(), total_time(0) {}
+    };
+
+    explicit LoadBalancer (size_t worker_count) :
+        workers_(worker_count),
+        owners_()
+    {
+    }
+
+    size_t worker_count () const { return workers_.size(); }
+    size_t task_count () const { return owners_.size(); }
+    Worker & worker (size_t w) { return workers_[w]; }
+    const Worker & worker (size_t w) const { return workers_[w]; }
+    size_t owner (size_t taskid) const { return owners_[taskid]; }
+
+    // Discards measured times, e.g. after tasks have been renumbered.
+    void invalidate () { owners_.clear(); }
+
+    // Reassigns tasks to workers by measured time since the last call.
+    // Tasks are costed by estimate(taskid) when no times are available,
+    // e.g. initially or after the task set has changed.
+    // Returns whether any task changed owner.
+    template<class Estimate>
+    bool rebalance (size_t task_count, const Estimate & estimate)
+    {
+        std::vector<usec_t> times;
+        _take_times(task_count, times);
+        usec_t total_time = 0;
+        for (auto time : times) {
+            total_time += time;
+        }
+        std::vector<double> costs(task_count);
+        for (size_t i = 0; i < task_count; ++i) {
+            costs[i] = total_time ? times[i] + 1.0 : estimate(i);
+        }
+        return _assign(costs);
+    }
+
+    template<class Message>
+    void log_metrics (Message & message)
+    {
+        for (auto & worker : workers_) {
+            message.add_times(worker.total_time);
+            message.add_kind_counts(worker.taskids.size());
+            worker.total_time = 0;
+        }
+    }
+
+private:
+
+    void _take_times (size_t task_count, std::vector<usec_t> & times)
+    {
+        times.clear();
+        times.resize(task_count, 0);
+        const bool unchanged = (task_count == owners_.size());
+        for (auto & worker : workers_) {
+            for (size_t j = 0; j < worker.times.size(); ++j) {
+                if (unchanged) {
+                    times[worker.taskids[j]] += worker.times[j];
+                }
+                worker.total_time += worker.times[j];
+                worker.times[j] = 0;
+            }
+        }
+    }
+
+    bool _assign (const std::vector<double> & costs)
+    {
+        const size_t task_count = costs.size();
+        std::vector<size_t> order(task_count);
+        for (size_t i = 0; i < task_count; ++i) {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(), [&](size_t x, size_t y){
+            return costs[x] > costs[y];
+        });
+
+        std::vector<double> loads(workers_.size(), 0);
+        for (auto & worker : workers_) {
+            worker.taskids.clear();
+        }
+        std::vector<size_t> old_owners;
+        old_owners.swap(owners_);
+        owners_.resize(task_count);
+        for (size_t i : order) {
+            size_t w = std::min_element(loads.begin(), loads.end())
+                     - loads.begin();
+            loads[w] += costs[i];
+            workers_[w].taskids.push_back(i);
+            owners_[i] = w;
+        }
+        for (auto & worker : workers_) {
+            // process tasks in order, for locality
+            std::sort(worker.taskids.begin(), worker.taskids.end());
+            worker.times.clear();
+            worker.times.resize(worker.taskids.size(), 0);
+        }
+        return owners_ != old_owners;
+    }
+
+    std::vector<Worker> workers_;
+    std::vector<size_t> owners_;
+};
+
+} // namespace loom
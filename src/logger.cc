@@ -29,6 +29,7 @@
 #include <loom/logger.hpp>
 #include <sys/resource.h>
 #include <loom/timer.hpp>
+#include <loom/allocation_counter.hpp>
 
 namespace loom
 {
@@ -45,6 +46,7 @@ void Logger::write_message ()
     rusage.set_max_resident_size_kb(usage.ru_maxrss);
     rusage.set_user_time_sec(get_time_sec(usage.ru_utime));
     rusage.set_sys_time_sec(get_time_sec(usage.ru_stime));
+    rusage.set_heap_allocation_count(heap_allocation_count());
 
     message_.set_timestamp_usec(current_time_usec());
 
@@ -60,10 +60,18 @@ Loom::Loom (
     const size_t empty_group_count =
         config_.kernels().cat().empty_group_count();
     LOOM_ASSERT_LT(0, empty_group_count);
+    const bool incremental_tare_cache = config_.incremental_tare_cache();
     if (groups_in) {
-        cross_cat_.mixture_load(groups_in, empty_group_count, rng);
+        cross_cat_.mixture_load(
+            groups_in,
+            empty_group_count,
+            incremental_tare_cache,
+            rng);
     } else {
-        cross_cat_.mixture_init_unobserved(empty_group_count, rng);
+        cross_cat_.mixture_init_unobserved(
+            empty_group_count,
+            incremental_tare_cache,
+            rng);
     }
 
     if (tares_in) {
@@ -110,6 +118,22 @@ void Loom::dump (
     }
 }
 
+static bool try_read_block (
+        protobuf::InFile & rows,
+        std::vector<protobuf::Row> & block,
+        size_t block_size)
+{
+    block.resize(block_size);
+    size_t row_count = 0;
+    while (row_count < block_size and rows.try_read_stream(block[row_count])) {
+        ++row_count;
+    }
+    if (row_count < block_size) {
+        block.resize(row_count);
+    }
+    return row_count;
+}
+
 void Loom::infer_single_pass (
         rng_t & rng,
         const char * rows_in,
@@ -118,8 +142,27 @@ void Loom::infer_single_pass (
     protobuf::InFile rows(rows_in);
     protobuf::Row row;
     CatKernel cat_kernel(config_.kernels().cat(), cross_cat_);
+    const size_t block_size = config_.kernels().cat().single_pass_block_size();
 
-    if (assign_out) {
+    if (block_size > 1) {
+
+        std::vector<protobuf::Row> block;
+        std::vector<protobuf::Assignment> packed_assignments;
+        if (assign_out) {
+            protobuf::OutFile assignments(assign_out);
+            while (try_read_block(rows, block, block_size)) {
+                cat_kernel.add_rows(rng, block, &packed_assignments);
+                for (const auto & assignment : packed_assignments) {
+                    assignments.write_stream(assignment);
+                }
+            }
+        } else {
+            while (try_read_block(rows, block, block_size)) {
+                cat_kernel.add_rows(rng, block, nullptr);
+            }
+        }
+
+    } else if (assign_out) {
 
         protobuf::OutFile assignments(assign_out);
         protobuf::Assignment assignment;
@@ -250,6 +293,7 @@ bool Loom::infer_kind_structure_sequential (
             logger([&](Logger::Message & message){
                 message.set_iter(checkpoint.tardis_iter());
                 log_metrics(message);
+                rows.log_metrics(message);
                 kind_kernel.log_metrics(message);
                 hyper_kernel.log_metrics(message);
             });
@@ -267,6 +311,7 @@ bool Loom::infer_kind_structure_sequential (
     logger([&](Logger::Message & message){
         message.set_iter(checkpoint.tardis_iter());
         log_metrics(message);
+        rows.log_metrics(message);
         kind_kernel.log_metrics(message);
     });
     return true;
@@ -316,6 +361,7 @@ bool Loom::infer_kind_structure_parallel (
             logger([&](Logger::Message & message){
                 message.set_iter(checkpoint.tardis_iter());
                 log_metrics(message);
+                rows.log_metrics(message);
                 pipeline.log_metrics(message);
                 hyper_kernel.log_metrics(message);
             });
@@ -334,6 +380,7 @@ bool Loom::infer_kind_structure_parallel (
     logger([&](Logger::Message & message){
         message.set_iter(checkpoint.tardis_iter());
         log_metrics(message);
+        rows.log_metrics(message);
         pipeline.log_metrics(message);
     });
     return true;
@@ -372,6 +419,7 @@ bool Loom::infer_cat_structure_sequential (
             logger([&](Logger::Message & message){
                 message.set_iter(checkpoint.tardis_iter());
                 log_metrics(message);
+                rows.log_metrics(message);
                 cat_kernel.log_metrics(message);
                 hyper_kernel.log_metrics(message);
             });
@@ -386,6 +434,7 @@ bool Loom::infer_cat_structure_sequential (
     logger([&](Logger::Message & message){
         message.set_iter(checkpoint.tardis_iter());
         log_metrics(message);
+        rows.log_metrics(message);
         cat_kernel.log_metrics(message);
     });
     return true;
@@ -428,10 +477,13 @@ bool Loom::infer_cat_structure_parallel (
             schedule.annealing.set_extra_passes(
                 schedule.accelerating.extra_passes(row_count));
             hyper_kernel.try_run(rng);
+            pipeline.rehome();
             checkpoint.set_tardis_iter(checkpoint.tardis_iter() + 1);
             logger([&](Logger::Message & message){
                 message.set_iter(checkpoint.tardis_iter());
                 log_metrics(message);
+                rows.log_metrics(message);
+                pipeline.log_metrics(message);
                 hyper_kernel.log_metrics(message);
             });
             if (schedule.checkpointing.test()) {
@@ -446,6 +498,8 @@ bool Loom::infer_cat_structure_parallel (
     logger([&](Logger::Message & message){
         message.set_iter(checkpoint.tardis_iter());
         log_metrics(message);
+        rows.log_metrics(message);
+        pipeline.log_metrics(message);
     });
     return true;
 }
@@ -29,19 +29,25 @@
 #pragma once
 
 #include <atomic>
+#include <list>
 #include <mutex>
 #include <thread>
+#include <vector>
+#include <algorithm>
 #include <condition_variable>
 #include <distributions/aligned_allocator.hpp>
 #include <loom/common.hpp>
 
 #ifdef LOOM_ASSUME_X86
+#  include <immintrin.h>
 #  define load_barrier() asm volatile("lfence":::"memory")
 #  define store_barrier() asm volatile("sfence":::"memory")
+#  define cpu_relax() _mm_pause()
 #else // LOOM_ASSUME_X86
 #  warn "defaulting to full memory barriers"
 #  define load_barrier() __sync_synchronize()
 #  define store_barrier() __sync_synchronize()
+#  define cpu_relax() asm volatile("":::"memory")
 #endif // LOOM_ASSUME_X86
 
 #if 0
@@ -149,28 +155,61 @@ private:
 
 class PipelineGuard
 {
+public:
+
+    // values match protobuf::Config::Kernels::WaitStrategy
+    enum Strategy {
+        BLOCK = 0,      // park on a condition variable immediately
+        SPIN = 1,       // spin and yield, never park
+        ADAPTIVE = 2    // spin, then yield, then park
+    };
+
+    enum {
+        spin_count = 256,
+        yield_count = 16
+    };
+
+private:
+
     PipelineState::pair_t state_;
     PipelineState::stage_t stage_;
+    Strategy strategy_;
+    std::atomic<uint_fast32_t> waiter_count_;
     std::mutex mutex_;
     std::condition_variable cond_variable_;
 
 public:
 
+    PipelineGuard () : strategy_(BLOCK), waiter_count_(0) {}
+
     void init (size_t stage_number, size_t count)
     {
         state_ = PipelineState::create_state(stage_number, count);
         stage_ = PipelineState::create_state(stage_number, 0);
     }
 
+    void set_strategy (Strategy strategy) { strategy_ = strategy; }
+
     size_t get_count () { return PipelineState::get_count(state_); }
 
     void acquire (const PipelineState & state)
     {
-        if (state.load_stage() != stage_) {
-            std::unique_lock<std::mutex> lock(mutex_);
-            cond_variable_.wait(lock, [&](){
-                return state.load_stage() == stage_;
-            });
+        if (LOOM_UNLIKELY(not _ready(state))) {
+            switch (strategy_) {
+                case BLOCK:
+                    _park(state);
+                    break;
+
+                case SPIN:
+                    while (not _try_spin(state)) {}
+                    break;
+
+                case ADAPTIVE:
+                    if (not _try_spin(state)) {
+                        _park(state);
+                    }
+                    break;
+            }
         }
         load_barrier();
     }
@@ -180,8 +219,12 @@ public:
         store_barrier();
         if (state.decrement_count() == 1) {
             state.store(state_);
-            std::unique_lock<std::mutex> lock(mutex_);
-            cond_variable_.notify_all();
+            // this read-modify-write is ordered against the one in _park,
+            // so either we see the waiter or the waiter sees the new state
+            if (waiter_count_.fetch_add(0, std::memory_order_acq_rel)) {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cond_variable_.notify_all();
+            }
         }
     }
 
@@ -194,6 +237,38 @@ public:
     {
         LOOM_ASSERT2(state.load_stage() == stage_, "state is not ready");
     }
+
+private:
+
+    bool _ready (const PipelineState & state) const
+    {
+        return state.load_stage() == stage_;
+    }
+
+    bool _try_spin (const PipelineState & state) const
+    {
+        for (size_t i = 0; i < spin_count; ++i) {
+            cpu_relax();
+            if (_ready(state)) {
+                return true;
+            }
+        }
+        for (size_t i = 0; i < yield_count; ++i) {
+            std::this_thread::yield();
+            if (_ready(state)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void _park (const PipelineState & state)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        waiter_count_.fetch_add(1, std::memory_order_acq_rel);
+        cond_variable_.wait(lock, [&](){ return _ready(state); });
+        waiter_count_.fetch_sub(1, std::memory_order_relaxed);
+    }
 };
 
 namespace detail
@@ -255,7 +330,10 @@ class PipelineQueue
 
 public:
 
-    PipelineQueue (size_t size, size_t stage_count) :
+    PipelineQueue (
+            size_t size,
+            size_t stage_count,
+            PipelineGuard::Strategy strategy = PipelineGuard::BLOCK) :
         envelopes_(size + 1),
         size_plus_one_(size + 1),
         stage_count_(stage_count),
@@ -268,8 +346,10 @@ public:
 
         for (size_t i = 0; i < stage_count_; ++i) {
             guards_[i].init(i, 0);
+            guards_[i].set_strategy(strategy);
         }
         guards_[stage_count_].init(stage_count_, 1);
+        guards_[stage_count_].set_strategy(strategy);
 
         PipelineGuard & guard = guards_[stage_count_];
         for (size_t i = 0; i < size_plus_one_; ++i) {
@@ -303,6 +383,16 @@ public:
         assert_ready();
     }
 
+    void unsafe_remove_consumer (size_t stage_number)
+    {
+        LOOM_ASSERT_LT(stage_number, stage_count_);
+        assert_ready();
+        LOOM_ASSERT_LT(0, consumer_counts_[stage_number]);
+        size_t count = --consumer_counts_[stage_number];
+        guards_[stage_number].init(stage_number, count);
+        assert_ready();
+    }
+
     void validate () const
     {
         assert_ready();
@@ -369,14 +459,26 @@ class Pipeline
         PipelineTask () : exit(false) {}
     };
 
+    // a list, so that retired threads can be erased while others keep
+    // pointers to their own retiring flags
+    struct Consumer
+    {
+        std::thread thread;
+        size_t stage_number;
+        bool retiring;
+    };
+
     PipelineQueue<PipelineTask, cache_line_size> queue_;
-    std::vector<std::thread> threads_;
+    std::list<Consumer> consumers_;
 
 public:
 
-    Pipeline (size_t capacity, size_t stage_count) :
-        queue_(capacity, stage_count),
-        threads_()
+    Pipeline (
+            size_t capacity,
+            size_t stage_count,
+            PipelineGuard::Strategy strategy = PipelineGuard::BLOCK) :
+        queue_(capacity, stage_count, strategy),
+        consumers_()
     {
     }
 
@@ -388,21 +490,60 @@ public:
     {
         queue_.unsafe_add_consumer(stage_number);
         size_t init_position = queue_.unsafe_position();
-        threads_.push_back(std::thread(
-                [this, stage_number, init_thread, init_position, fun](){
+        consumers_.push_back(Consumer());
+        Consumer & consumer = consumers_.back();
+        consumer.stage_number = stage_number;
+        consumer.retiring = false;
+        const bool * retiring = & consumer.retiring;
+        consumer.thread = std::thread([
+                this,
+                retiring,
+                stage_number,
+                init_thread,
+                init_position,
+                fun](){
             ThreadState thread = init_thread;
             size_t position = init_position;
             for (bool alive = true; LOOM_LIKELY(alive);) {
                 queue_.consume(stage_number, position, [&](PipelineTask & task){
                     if (LOOM_UNLIKELY(task.exit)) {
-                        alive = false;
+                        alive = not * retiring;
                     } else {
                         fun(task.task, thread);
                     }
                 });
                 ++position;
             }
-        }));
+        });
+    }
+
+    // Retires the most recently added count threads of a stage.
+    // This requires the pipeline to be empty, i.e. after wait().
+    void unsafe_remove_threads (size_t stage_number, size_t count)
+    {
+        size_t found = 0;
+        for (auto i = consumers_.rbegin(); i != consumers_.rend(); ++i) {
+            if (found == count) {
+                break;
+            }
+            if (i->stage_number == stage_number) {
+                i->retiring = true;
+                ++found;
+            }
+        }
+        LOOM_ASSERT_EQ(found, count);
+        if (count) {
+            _broadcast_exit();
+            for (auto i = consumers_.begin(); i != consumers_.end();) {
+                if (i->retiring) {
+                    i->thread.join();
+                    queue_.unsafe_remove_consumer(stage_number);
+                    i = consumers_.erase(i);
+                } else {
+                    ++i;
+                }
+            }
+        }
     }
 
     void validate ()
@@ -413,7 +554,10 @@ public:
     template<class Fun>
     void start (const Fun & fun)
     {
-        queue_.produce([fun](PipelineTask & task){ fun(task.task); });
+        queue_.produce([fun](PipelineTask & task){
+            task.exit = false;
+            fun(task.task);
+        });
     }
 
     void wait ()
@@ -422,12 +566,23 @@ public:
     }
 
     ~Pipeline ()
+    {
+        for (auto & consumer : consumers_) {
+            consumer.retiring = true;
+        }
+        _broadcast_exit();
+        for (auto & consumer : consumers_) {
+            consumer.thread.join();
+        }
+    }
+
+private:
+
+    // threads marked as retiring exit on this task; others skip it
+    void _broadcast_exit ()
     {
         queue_.produce([](PipelineTask & task) { task.exit = true; });
         queue_.wait();
-        for (auto & thread : threads_) {
-            thread.join();
-        }
     }
 };
 
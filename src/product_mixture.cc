@@ -26,6 +26,7 @@
 // TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
 // USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+#include <atomic>
 #include <loom/product_mixture.hpp>
 #include <distributions/assert_close.hpp>
 
@@ -79,6 +80,7 @@ inline void ProductMixture_<true>::_update_tare_cache (
         read_value(fun, model.schema, features, model.tares[i]);
         tare_caches[i].scores[groupid] = fun.score;
     }
+    tare_update_counts_[groupid] = 0;
 }
 
 template<>
@@ -89,6 +91,207 @@ inline void ProductMixture_<false>::_update_tare_cache (
 {
 }
 
+//----------------------------------------------------------------------------
+// Incremental tare cache updates
+//
+// Each tare's cached score is a sum over that tare's observed features,
+// and a diff only changes the sufficient statistics of the features it
+// touches.  Rather than rescoring every tare, we mark the touched
+// features, score them before and after the update, and add the
+// difference to each tare's cache.  Caches are fully rescored
+// periodically to bound floating point drift, and whenever a diff
+// touches most features, in which case marking would not pay off.
+
+template<bool cached>
+struct ProductMixture_<cached>::init_tare_marks_fun
+{
+    TareMarks & marks;
+    const ProductModel::Features & shareds;
+    const bool reset;
+
+    template<class T>
+    void operator() (T * t)
+    {
+        const size_t size = shareds[t].size();
+        if (reset or marks[t].size() != size) {
+            marks[t].assign(size, 0);
+        }
+    }
+};
+
+template<bool cached>
+struct ProductMixture_<cached>::mark_tare_fun
+{
+    TareMarks & marks;
+    const uint32_t mark;
+    size_t & count;
+
+    template<class T>
+    void operator() (
+            T * t,
+            size_t i,
+            const typename T::Value &)
+    {
+        auto & marked = marks[t][i];
+        if (marked != mark) {
+            marked = mark;
+            ++count;
+        }
+    }
+};
+
+template<bool cached>
+struct ProductMixture_<cached>::score_marked_group_fun
+{
+    const Features & mixtures;
+    const ProductModel::Features & shareds;
+    const TareMarks & marks;
+    const uint32_t mark;
+    size_t groupid;
+    rng_t & rng;
+
+    float score;
+
+    template<class T>
+    void operator() (
+            T * t,
+            size_t i,
+            const typename T::Value & value)
+    {
+        if (marks[t][i] == mark) {
+            score += mixtures[t][i].score_value_group(
+                shareds[t][i],
+                groupid,
+                value,
+                rng);
+        }
+    }
+};
+
+// each group's tare scores are fully recomputed after this many
+// incremental updates to that group, to bound rounding drift
+static const uint32_t TARE_REFRESH_PERIOD = 4096;
+
+template<>
+template<class D>
+inline bool ProductMixture_<true>::_begin_tare_update (
+        const ProductModel & model,
+        size_t groupid,
+        const D & diff,
+        rng_t & rng)
+{
+    const size_t tare_count = model.tares.size();
+    if (not incremental_tare_cache or tare_count == 0) {
+        return false;
+    }
+    if (LOOM_UNLIKELY(
+            ++tare_update_counts_[groupid] >= TARE_REFRESH_PERIOD)) {
+        return false;
+    }
+
+    const bool reset = LOOM_UNLIKELY(++tare_mark_ == 0);
+    if (reset) {
+        tare_mark_ = 1;
+    }
+    {
+        init_tare_marks_fun fun = {tare_marks_, model.features, reset};
+        for_each_feature_type(fun);
+    }
+
+    size_t marked_count = 0;
+    {
+        mark_tare_fun fun = {tare_marks_, tare_mark_, marked_count};
+        for (auto id : diff.tares()) {
+            LOOM_ASSERT1(id < tare_count, "bad tare id: " << id);
+            read_value(fun, model.schema, features, model.tares[id]);
+        }
+        read_value(fun, model.schema, features, diff.pos());
+        read_value(fun, model.schema, features, diff.neg());
+    }
+    if (2 * marked_count >= model.schema.total_size()) {
+        return false;
+    }
+
+    tare_partials_.resize(tare_count);
+    score_marked_group_fun fun = {
+        features,
+        model.features,
+        tare_marks_,
+        tare_mark_,
+        groupid,
+        rng,
+        0.f};
+    for (size_t i = 0; i < tare_count; ++i) {
+        fun.score = 0.f;
+        read_value(fun, model.schema, features, model.tares[i]);
+        tare_partials_[i] = fun.score;
+    }
+    return true;
+}
+
+template<>
+template<class D>
+inline bool ProductMixture_<false>::_begin_tare_update (
+        const ProductModel &,
+        size_t,
+        const D &,
+        rng_t &)
+{
+    return false;
+}
+
+template<>
+inline void ProductMixture_<true>::_end_tare_update (
+        const ProductModel & model,
+        size_t groupid,
+        bool incremental,
+        rng_t & rng)
+{
+    if (not incremental) {
+        _update_tare_cache(model, groupid, rng);
+        return;
+    }
+
+    score_marked_group_fun fun = {
+        features,
+        model.features,
+        tare_marks_,
+        tare_mark_,
+        groupid,
+        rng,
+        0.f};
+    for (size_t i = 0, size = model.tares.size(); i < size; ++i) {
+        fun.score = 0.f;
+        read_value(fun, model.schema, features, model.tares[i]);
+        tare_caches[i].scores[groupid] += fun.score - tare_partials_[i];
+    }
+
+    if (LOOM_DEBUG_LEVEL >= 3) {
+        score_value_group_fun fun = {
+            features,
+            model.features,
+            groupid,
+            rng,
+            0.f};
+        for (size_t i = 0, size = model.tares.size(); i < size; ++i) {
+            fun.score = 0.f;
+            read_value(fun, model.schema, features, model.tares[i]);
+            const float actual = tare_caches[i].scores[groupid];
+            const float tol = 1e-3f * (1.f + fabs(fun.score));
+            LOOM_ASSERT_LT(fabs(actual - fun.score), tol);
+        }
+    }
+}
+
+template<>
+inline void ProductMixture_<false>::_end_tare_update (
+        const ProductModel &,
+        size_t,
+        bool,
+        rng_t &)
+{
+}
+
 template<>
 inline void ProductMixture_<true>::_add_tare_cache (
         const ProductModel & model,
@@ -97,6 +300,7 @@ inline void ProductMixture_<true>::_add_tare_cache (
     for (auto & tare_cache : tare_caches) {
         tare_cache.scores.packed_add();
     }
+    tare_update_counts_.packed_add(0);
     _update_tare_cache(model, clustering.counts().size() - 1, rng);
 }
 
@@ -116,6 +320,7 @@ inline void ProductMixture_<true>::_remove_tare_cache (size_t groupid)
     for (auto & tare_cache : tare_caches) {
         tare_cache.scores.packed_remove(groupid);
     }
+    tare_update_counts_.packed_remove(groupid);
 }
 
 template<>
@@ -129,6 +334,95 @@ inline void ProductMixture_<false>::_remove_tare_cache (size_t groupid)
     }
 }
 
+template<>
+inline void ProductMixture_<true>::_add_columnar_group (
+        const ProductModel & model,
+        rng_t & rng)
+{
+    if (columnar.valid()) {
+        columnar.add_group(model, features, rng);
+    }
+}
+
+template<>
+inline void ProductMixture_<false>::_add_columnar_group (
+        const ProductModel &,
+        rng_t &)
+{
+}
+
+template<>
+inline void ProductMixture_<true>::_remove_columnar_group (size_t groupid)
+{
+    if (columnar.valid()) {
+        columnar.remove_group(groupid);
+    }
+}
+
+template<>
+inline void ProductMixture_<false>::_remove_columnar_group (size_t)
+{
+}
+
+template<>
+template<class V>
+inline void ProductMixture_<true>::_update_columnar_value (
+        const ProductModel & model,
+        size_t groupid,
+        const V & value,
+        rng_t & rng)
+{
+    if (LOOM_LIKELY(columnar.valid())) {
+        columnar.update_value(model, features, groupid, value, rng);
+    } else {
+        columnar.init(model, features, clustering.counts().size(), rng);
+    }
+}
+
+template<>
+template<class V>
+inline void ProductMixture_<false>::_update_columnar_value (
+        const ProductModel &,
+        size_t,
+        const V &,
+        rng_t &)
+{
+}
+
+template<>
+template<class D>
+inline void ProductMixture_<true>::_update_columnar_diff (
+        const ProductModel & model,
+        size_t groupid,
+        const D & diff,
+        rng_t & rng)
+{
+    if (LOOM_LIKELY(columnar.valid())) {
+        for (auto id : diff.tares()) {
+            columnar.update_value(
+                model,
+                features,
+                groupid,
+                model.tares[id],
+                rng);
+        }
+        columnar.update_value(model, features, groupid, diff.pos(), rng);
+        columnar.update_value(model, features, groupid, diff.neg(), rng);
+    } else {
+        columnar.init(model, features, clustering.counts().size(), rng);
+    }
+}
+
+template<>
+template<class D>
+inline void ProductMixture_<false>::_update_columnar_diff (
+        const ProductModel &,
+        size_t,
+        const D &,
+        rng_t &)
+{
+}
+
 template<bool cached>
 struct ProductMixture_<cached>::add_group_fun
 {
@@ -164,10 +458,11 @@ struct ProductMixture_<cached>::add_value_fun
 };
 
 template<bool cached>
+template<class V>
 void ProductMixture_<cached>::add_value (
         const ProductModel & model,
         size_t groupid,
-        const Value & value,
+        const V & value,
         rng_t & rng)
 {
     LOOM_ASSERT1(maintaining_cache, "cache is not being maintained");
@@ -179,9 +474,11 @@ void ProductMixture_<cached>::add_value (
     if (LOOM_UNLIKELY(add_group)) {
         add_group_fun fun = {features, rng};
         for_each_feature(fun, model.features);
+        _add_columnar_group(model, rng);
         id_tracker.add_group();
         validate(model);
     }
+    _update_columnar_value(model, groupid, value, rng);
 }
 
 template<bool cached>
@@ -219,10 +516,11 @@ struct ProductMixture_<cached>::remove_value_fun
 };
 
 template<bool cached>
+template<class V>
 void ProductMixture_<cached>::remove_value (
         const ProductModel & model,
         size_t groupid,
-        const Value & value,
+        const V & value,
         rng_t & rng)
 {
     LOOM_ASSERT1(maintaining_cache, "cache is not being maintained");
@@ -234,21 +532,26 @@ void ProductMixture_<cached>::remove_value (
     if (LOOM_UNLIKELY(remove_group)) {
         remove_group_fun fun = {features, groupid};
         for_each_feature(fun, model.features);
+        _remove_columnar_group(groupid);
         id_tracker.remove_group(groupid);
         validate(model);
+    } else {
+        _update_columnar_value(model, groupid, value, rng);
     }
 }
 
 template<bool cached>
+template<class D>
 void ProductMixture_<cached>::add_diff (
         const ProductModel & model,
         size_t groupid,
-        const Value::Diff & diff,
+        const D & diff,
         rng_t & rng)
 {
     LOOM_ASSERT1(maintaining_cache, "cache is not being maintained");
 
     bool add_group = clustering.add_value(model.clustering, groupid);
+    bool incremental = _begin_tare_update(model, groupid, diff, rng);
     {
         add_value_fun fun = {features, model.features, groupid, rng};
         for (auto id : diff.tares()) {
@@ -261,27 +564,32 @@ void ProductMixture_<cached>::add_diff (
         remove_value_fun fun = {features, model.features, groupid, rng};
         read_value(fun, model.schema, features, diff.neg());
     }
-    _update_tare_cache(model, groupid, rng);
+    _end_tare_update(model, groupid, incremental, rng);
 
     if (LOOM_UNLIKELY(add_group)) {
         add_group_fun fun = {features, rng};
         for_each_feature(fun, model.features);
         _add_tare_cache(model, rng);
+        _add_columnar_group(model, rng);
         id_tracker.add_group();
         validate(model);
     }
+    _update_columnar_diff(model, groupid, diff, rng);
 }
 
 template<bool cached>
+template<class D>
 void ProductMixture_<cached>::remove_diff (
         const ProductModel & model,
         size_t groupid,
-        const Value::Diff & diff,
+        const D & diff,
         rng_t & rng)
 {
     LOOM_ASSERT1(maintaining_cache, "cache is not being maintained");
 
     bool remove_group = clustering.remove_value(model.clustering, groupid);
+    bool incremental =
+        not remove_group and _begin_tare_update(model, groupid, diff, rng);
     {
         add_value_fun fun = {features, model.features, groupid, rng};
         read_value(fun, model.schema, features, diff.neg());
@@ -299,10 +607,12 @@ void ProductMixture_<cached>::remove_diff (
         remove_group_fun fun = {features, groupid};
         for_each_feature(fun, model.features);
         _remove_tare_cache(groupid);
+        _remove_columnar_group(groupid);
         id_tracker.remove_group(groupid);
         validate(model);
     } else {
-        _update_tare_cache(model, groupid, rng);
+        _end_tare_update(model, groupid, incremental, rng);
+        _update_columnar_diff(model, groupid, diff, rng);
     }
 }
 
@@ -420,38 +730,105 @@ struct ProductMixture_<cached>::score_value_fun
 };
 
 template<>
+template<class V>
+void ProductMixture_<true>::_validate_columnar (
+        const ProductModel & model,
+        const V & value,
+        const VectorFloat & scores,
+        rng_t & rng) const
+{
+    VectorFloat expected(clustering.counts().size());
+    clustering.score_value(model.clustering, expected);
+    score_value_fun fun = {features, model.features, expected, rng};
+    read_value(fun, model.schema, features, value);
+    LOOM_ASSERT_EQ(scores.size(), expected.size());
+    for (size_t i = 0, size = scores.size(); i < size; ++i) {
+        const float tol = 1e-3f * (1.f + fabs(expected[i]));
+        LOOM_ASSERT_LT(fabs(scores[i] - expected[i]), tol);
+    }
+}
+
+template<>
+template<class V>
+void ProductMixture_<false>::_validate_columnar (
+        const ProductModel &,
+        const V &,
+        const VectorFloat &,
+        rng_t &) const
+{
+}
+
+template<>
+template<class V>
 void ProductMixture_<true>::score_value (
         const ProductModel & model,
-        const Value & value,
+        const V & value,
         VectorFloat & scores,
         rng_t & rng) const
 {
     LOOM_ASSERT1(maintaining_cache, "cache is not being maintained");
+    if (LOOM_DEBUG_LEVEL >= 3) {
+        _validate_fresh(model);
+    }
 
     scores.resize(clustering.counts().size());
     clustering.score_value(model.clustering, scores);
-    score_value_fun fun = {features, model.features, scores, rng};
-    read_value(fun, model.schema, features, value);
+    if (columnar.valid()) {
+        columnar.score_value(model, features, value, scores, rng);
+        if (LOOM_DEBUG_LEVEL >= 3) {
+            _validate_columnar(model, value, scores, rng);
+        }
+    } else {
+        score_value_fun fun = {features, model.features, scores, rng};
+        read_value(fun, model.schema, features, value);
+    }
 }
 
 template<>
+template<class D>
 void ProductMixture_<true>::score_diff (
         const ProductModel & model,
-        const Value::Diff & diff,
+        const D & diff,
         VectorFloat & scores,
         rng_t & rng) const
 {
     LOOM_ASSERT1(maintaining_cache, "cache is not being maintained");
+    if (LOOM_DEBUG_LEVEL >= 3) {
+        _validate_fresh(model);
+    }
 
-    const size_t size = clustering.counts().size();
-    scores.resize(size);
+    scores.resize(clustering.counts().size());
     clustering.score_value(model.clustering, scores);
-    score_value_fun fun = {features, model.features, scores, rng};
-    read_value(fun, model.schema, features, diff.pos());
-    if (model.schema.total_size(diff.neg())) {
-        distributions::vector_negate(size, scores.data());
-        read_value(fun, model.schema, features, diff.neg());
-        distributions::vector_negate(size, scores.data());
+    score_diff_groups(model, diff, scores, rng);
+}
+
+template<>
+template<class D>
+void ProductMixture_<true>::score_diff_groups (
+        const ProductModel & model,
+        const D & diff,
+        VectorFloat & scores,
+        rng_t & rng) const
+{
+    const size_t size = clustering.counts().size();
+    if (LOOM_DEBUG_LEVEL >= 1) {
+        LOOM_ASSERT_EQ(scores.size(), size);
+    }
+    if (columnar.valid()) {
+        columnar.score_value(model, features, diff.pos(), scores, rng);
+        if (model.schema.total_size(diff.neg())) {
+            distributions::vector_negate(size, scores.data());
+            columnar.score_value(model, features, diff.neg(), scores, rng);
+            distributions::vector_negate(size, scores.data());
+        }
+    } else {
+        score_value_fun fun = {features, model.features, scores, rng};
+        read_value(fun, model.schema, features, diff.pos());
+        if (model.schema.total_size(diff.neg())) {
+            distributions::vector_negate(size, scores.data());
+            read_value(fun, model.schema, features, diff.neg());
+            distributions::vector_negate(size, scores.data());
+        }
     }
     for (auto id : diff.tares()) {
         LOOM_ASSERT1(id < model.tares.size(), "bad tare id: " << id);
@@ -463,6 +840,32 @@ void ProductMixture_<true>::score_diff (
     }
 }
 
+template<>
+template<class D>
+float ProductMixture_<true>::score_diff_group (
+        const ProductModel & model,
+        size_t groupid,
+        const D & diff,
+        rng_t & rng) const
+{
+    LOOM_ASSERT1(maintaining_cache, "cache is not being maintained");
+
+    score_value_group_fun fun = {
+        features,
+        model.features,
+        groupid,
+        rng,
+        0.f};
+    read_value(fun, model.schema, features, diff.neg());
+    fun.score = -fun.score;
+    read_value(fun, model.schema, features, diff.pos());
+    for (auto id : diff.tares()) {
+        LOOM_ASSERT1(id < model.tares.size(), "bad tare id: " << id);
+        fun.score += tare_caches[id].scores[groupid];
+    }
+    return fun.score;
+}
+
 template<bool cached>
 struct ProductMixture_<cached>::score_value_features_fun
 {
@@ -530,17 +933,71 @@ void ProductMixture_<cached>::init_feature_cache (
         size_t featureid,
         rng_t & rng)
 {
+    columnar.invalidate();
     if (maintaining_cache) {
         init_feature_cache_fun fun = {model.features, rng};
         for_one_feature(fun, features, featureid);
+        fresh_feature_caches.find(featureid) = true;
     }
 }
 
+template<bool cached>
+struct ProductMixture_<cached>::init_fresh_feature_caches_fun
+{
+    IndexedVector<uint8_t> & fresh_feature_caches;
+    const ProductModel::Features & shareds;
+    const bool fresh;
+
+    template<class T>
+    void operator() (T * t)
+    {
+        for (auto featureid : shareds[t].index()) {
+            fresh_feature_caches.insert(featureid) = fresh;
+        }
+    }
+};
+
+template<bool cached>
+void ProductMixture_<cached>::_init_fresh_feature_caches (
+        const ProductModel & model,
+        bool fresh)
+{
+    fresh_feature_caches.clear();
+    init_fresh_feature_caches_fun fun = {
+        fresh_feature_caches,
+        model.features,
+        fresh};
+    for_each_feature_type(fun);
+}
+
+namespace
+{
+
+std::atomic<uint64_t> g_next_storage_stamp(1);
+
+} // anonymous namespace
+
+template<bool cached>
+void ProductMixture_<cached>::restamp ()
+{
+    storage_stamp = g_next_storage_stamp.fetch_add(1);
+}
+
 template<bool cached>
 void ProductMixture_<cached>::init_tare_cache (
         const ProductModel & model,
         rng_t & rng)
 {
+    restamp();
+    tare_mark_ = 0;
+    tare_update_counts_.clear();
+    if (cached) {
+        tare_update_counts_.resize(clustering.counts().size(), 0);
+    }
+    {
+        init_tare_marks_fun fun = {tare_marks_, model.features, true};
+        for_each_feature_type(fun);
+    }
     if (maintaining_cache) {
         tare_caches.resize(model.tares.size());
         const size_t group_count = clustering.counts().size();
@@ -559,6 +1016,7 @@ void ProductMixture_<cached>::init_tare_cache (
                 tare_cache.counts.resize(group_count, 0);
             }
         }
+        fresh_tare_caches = true;
     }
 }
 
@@ -686,6 +1144,7 @@ void ProductMixture_<cached>::init_unobserved (
 {
     clustering.counts() = counts;
     clustering.init(model.clustering);
+    columnar.invalidate();
 
     init_unobserved_fun fun = {
         counts.size(),
@@ -694,7 +1153,9 @@ void ProductMixture_<cached>::init_unobserved (
         maintaining_cache,
         rng};
     for_each_feature_type(fun);
+    _init_fresh_feature_caches(model, maintaining_cache);
 
+    fresh_tare_caches = false;
     init_tare_cache(model, rng);
     id_tracker.init(counts.size());
 
@@ -745,6 +1206,9 @@ void ProductMixture_<cached>::load_step_1_of_3 (
 {
     clear_fun fun = {model.features, features};
     for_each_feature_type(fun);
+    _init_fresh_feature_caches(model, false);
+    fresh_tare_caches = false;
+    columnar.invalidate();
     auto & counts = clustering.counts();
     counts.clear();
     for (auto & tare_cache : tare_caches) {
@@ -763,6 +1227,10 @@ void ProductMixture_<cached>::load_step_1_of_3 (
     counts.resize(counts.size() + empty_group_count, 0);
     clustering.init(model.clustering);
     id_tracker.init(counts.size());
+    tare_update_counts_.clear();
+    if (cached) {
+        tare_update_counts_.resize(counts.size(), 0);
+    }
 }
 
 template<bool cached>
@@ -806,6 +1274,7 @@ void ProductMixture_<cached>::load_step_2_of_3 (
         maintaining_cache,
         rng};
     for_one_feature(fun, features, featureid);
+    fresh_feature_caches.find(featureid) = maintaining_cache;
 }
 
 template<bool cached>
@@ -910,6 +1379,12 @@ void ProductMixture_<cached>::move_feature_to (
         source_model.features, source_mixture.features,
         destin_model.features, destin_mixture.features};
     for_one_feature(fun, features, featureid);
+    source_mixture.columnar.invalidate();
+    destin_mixture.columnar.invalidate();
+    source_mixture.fresh_feature_caches.remove(featureid);
+    destin_mixture.fresh_feature_caches.insert(featureid) = false;
+    source_mixture.fresh_tare_caches = false;
+    destin_mixture.fresh_tare_caches = false;
 
     source_model.schema.load(source_model.features);
     destin_model.schema.load(destin_model.features);
@@ -962,6 +1437,39 @@ void ProductMixture_<cached>::validate_subset (
 
 template struct ProductMixture_<true>;
 template struct ProductMixture_<false>;
+
+#define LOOM_INSTANTIATE_VALUE(cached, V)                                   \
+    template void ProductMixture_<cached>::add_value (                      \
+            const ProductModel &, size_t, const V &, rng_t &);              \
+    template void ProductMixture_<cached>::remove_value (                   \
+            const ProductModel &, size_t, const V &, rng_t &);
+#define LOOM_INSTANTIATE_DIFF(cached, D)                                    \
+    template void ProductMixture_<cached>::add_diff (                       \
+            const ProductModel &, size_t, const D &, rng_t &);              \
+    template void ProductMixture_<cached>::remove_diff (                    \
+            const ProductModel &, size_t, const D &, rng_t &);
+#define LOOM_INSTANTIATE_SCORE(V, D)                                        \
+    template void ProductMixture_<true>::score_value (                      \
+            const ProductModel &, const V &, VectorFloat &, rng_t &) const; \
+    template void ProductMixture_<true>::score_diff (                       \
+            const ProductModel &, const D &, VectorFloat &, rng_t &) const; \
+    template void ProductMixture_<true>::score_diff_groups (                \
+            const ProductModel &, const D &, VectorFloat &, rng_t &) const; \
+    template float ProductMixture_<true>::score_diff_group (                \
+            const ProductModel &, size_t, const D &, rng_t &) const;
+
+LOOM_INSTANTIATE_VALUE(true, ProductValue)
+LOOM_INSTANTIATE_VALUE(false, ProductValue)
+LOOM_INSTANTIATE_VALUE(true, FlatValue)
+LOOM_INSTANTIATE_DIFF(true, ProductValue::Diff)
+LOOM_INSTANTIATE_DIFF(false, ProductValue::Diff)
+LOOM_INSTANTIATE_DIFF(true, FlatDiff)
+LOOM_INSTANTIATE_SCORE(ProductValue, ProductValue::Diff)
+LOOM_INSTANTIATE_SCORE(FlatValue, FlatDiff)
+
+#undef LOOM_INSTANTIATE_SCORE
+#undef LOOM_INSTANTIATE_DIFF
+#undef LOOM_INSTANTIATE_VALUE
 template void ProductMixture_<false>::validate_subset (
         const ProductMixture_<true> &) const;
 template void ProductMixture_<false>::move_feature_to (
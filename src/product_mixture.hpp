@@ -29,6 +29,7 @@
 #pragma once
 
 #include <loom/product_model.hpp>
+#include <loom/columnar_mixture.hpp>
 
 namespace loom
 {
@@ -61,8 +62,24 @@ struct ProductMixture_
     Features features;
     std::vector<TareCache> tare_caches;
     distributions::MixtureIdTracker id_tracker;
+    ColumnarMixture columnar;
     bool maintaining_cache;
 
+    // When set, tare caches are updated by rescoring only the features
+    // touched by each diff, rather than every feature of every tare.
+    bool incremental_tare_cache;
+
+    // Caches stay valid while maintaining_cache is unset, except for
+    // features moved between kinds and features whose hypers change;
+    // these flags mark which caches need not be rebuilt by init_cache.
+    IndexedVector<uint8_t> fresh_feature_caches;
+    bool fresh_tare_caches;
+
+    // Unique across mixtures and renewed by restamp() whenever storage is
+    // rebuilt outside of add/remove, so that pipelines can tell which
+    // mixtures to re-place on their threads' numa nodes.
+    uint64_t storage_stamp;
+
     void init_unobserved (
             const ProductModel & model,
             const std::vector<int> & counts,
@@ -87,28 +104,34 @@ struct ProductMixture_
             const char * filename,
             const std::vector<uint32_t> & sorted_to_global) const;
 
+    // V is ProductValue or FlatValue; D is ProductValue::Diff or FlatDiff
+
+    template<class V>
     void add_value (
             const ProductModel & model,
             size_t groupid,
-            const Value & value,
+            const V & value,
             rng_t & rng);
 
+    template<class V>
     void remove_value (
             const ProductModel & model,
             size_t groupid,
-            const Value & value,
+            const V & value,
             rng_t & rng);
 
+    template<class D>
     void add_diff (
             const ProductModel & model,
             size_t groupid,
-            const Value::Diff & diff,
+            const D & diff,
             rng_t & rng);
 
+    template<class D>
     void remove_diff (
             const ProductModel & model,
             size_t groupid,
-            const Value::Diff & diff,
+            const D & diff,
             rng_t & rng);
 
     void add_diff_step_1_of_2 (
@@ -125,18 +148,36 @@ struct ProductMixture_
             const ProductModel & model,
             size_t groupid);
 
+    template<class V>
     void score_value (
             const ProductModel & model,
-            const Value & value,
+            const V & value,
             VectorFloat & scores,
             rng_t & rng) const;
 
+    template<class D>
     void score_diff (
             const ProductModel & model,
-            const Value::Diff & diff,
+            const D & diff,
+            VectorFloat & scores,
+            rng_t & rng) const;
+
+    // like score_diff but without the clustering prior,
+    // accumulating into scores of size group count
+    template<class D>
+    void score_diff_groups (
+            const ProductModel & model,
+            const D & diff,
             VectorFloat & scores,
             rng_t & rng) const;
 
+    template<class D>
+    float score_diff_group (
+            const ProductModel & model,
+            size_t groupid,
+            const D & diff,
+            rng_t & rng) const;
+
     void score_value_features (
             const ProductModel & model,
             const Value & value,
@@ -176,6 +217,10 @@ struct ProductMixture_
             const ProductModel & model,
             rng_t & rng);
 
+    // init_tare_cache restamps; callers that rebuild per-feature storage,
+    // possibly in parallel, must restamp afterwards.
+    void restamp ();
+
     void validate (const ProductModel & model) const;
 
     size_t count_rows () const
@@ -186,14 +231,63 @@ struct ProductMixture_
 
 private:
 
+    void _init_fresh_feature_caches (const ProductModel & model, bool fresh);
+    void _validate_fresh (const ProductModel & model) const;
     void _add_tare_cache (const ProductModel & model, rng_t & rng);
     void _remove_tare_cache (size_t groupid);
     void _update_tare_cache (
             const ProductModel & model,
             size_t groupid,
             rng_t & rng);
+    template<class D>
+    bool _begin_tare_update (
+            const ProductModel & model,
+            size_t groupid,
+            const D & diff,
+            rng_t & rng);
+    void _end_tare_update (
+            const ProductModel & model,
+            size_t groupid,
+            bool incremental,
+            rng_t & rng);
+    void _add_columnar_group (const ProductModel & model, rng_t & rng);
+    void _remove_columnar_group (size_t groupid);
+    template<class V>
+    void _update_columnar_value (
+            const ProductModel & model,
+            size_t groupid,
+            const V & value,
+            rng_t & rng);
+    template<class D>
+    void _update_columnar_diff (
+            const ProductModel & model,
+            size_t groupid,
+            const D & diff,
+            rng_t & rng);
+    template<class V>
+    void _validate_columnar (
+            const ProductModel & model,
+            const V & value,
+            const VectorFloat & scores,
+            rng_t & rng) const;
+
+    struct TareMark
+    {
+        template<class T>
+        struct Container
+        {
+            typedef std::vector<uint32_t> t;
+        };
+    };
+    typedef ForEachFeatureType<TareMark> TareMarks;
+
+    TareMarks tare_marks_;
+    uint32_t tare_mark_;
+    distributions::Packed_<uint32_t> tare_update_counts_;
+    std::vector<float> tare_partials_;
 
     struct validate_fun;
+    struct init_fresh_feature_caches_fun;
     struct clear_fun;
     struct load_group_fun;
     struct init_groups_fun;
@@ -209,6 +303,9 @@ private:
     struct score_value_fun;
     struct score_value_features_fun;
     struct score_value_group_fun;
+    struct init_tare_marks_fun;
+    struct mark_tare_fun;
+    struct score_marked_group_fun;
     struct score_feature_fun;
     struct score_data_fun;
     struct sample_fun;
@@ -247,6 +344,21 @@ struct ProductMixture_<cached>::validate_fun
     }
 };
 
+template<bool cached>
+inline void ProductMixture_<cached>::_validate_fresh (
+        const ProductModel & model) const
+{
+    LOOM_ASSERT_EQ(fresh_feature_caches.size(), model.schema.total_size());
+    for (size_t i = 0, size = fresh_feature_caches.size(); i < size; ++i) {
+        LOOM_ASSERT(
+            fresh_feature_caches[i],
+            "stale cache for feature " << fresh_feature_caches.index(i));
+    }
+    LOOM_ASSERT(
+        fresh_tare_caches or model.tares.empty(),
+        "stale tare caches");
+}
+
 template<bool cached>
 inline void ProductMixture_<cached>::validate (
         const ProductModel & model) const
@@ -263,6 +375,7 @@ inline void ProductMixture_<cached>::validate (
             maintaining_cache};
         for_each_feature_type(fun);
         if (maintaining_cache) {
+            _validate_fresh(model);
             LOOM_ASSERT_EQ(tare_caches.size(), model.tares.size());
             for (auto & tare_cache : tare_caches) {
                 if (cached) {
@@ -275,6 +388,7 @@ inline void ProductMixture_<cached>::validate (
             }
         }
         LOOM_ASSERT_EQ(id_tracker.packed_size(), group_count);
+        LOOM_ASSERT_EQ(tare_update_counts_.size(), cached ? group_count : 0);
     }
 }
 
@@ -63,10 +63,15 @@ struct ProductModel
 
     void extend (const ProductModel & other);
 
-    void add_value (const Value & value, rng_t & rng);
-    void remove_value (const Value & value, rng_t & rng);
-    void add_diff (const Value::Diff & diff, rng_t & rng);
-    void remove_diff (const Value::Diff & diff, rng_t & rng);
+    // V is ProductValue or FlatValue; D is ProductValue::Diff or FlatDiff
+    template<class V>
+    void add_value (const V & value, rng_t & rng);
+    template<class V>
+    void remove_value (const V & value, rng_t & rng);
+    template<class D>
+    void add_diff (const D & diff, rng_t & rng);
+    template<class D>
+    void remove_diff (const D & diff, rng_t & rng);
     void realize (rng_t & rng);
 
     void validate () const;
@@ -106,8 +111,9 @@ struct ProductModel::add_value_fun
     }
 };
 
+template<class V>
 inline void ProductModel::add_value (
-        const Value & value,
+        const V & value,
         rng_t & rng)
 {
     add_value_fun fun = {features, rng};
@@ -129,23 +135,26 @@ struct ProductModel::remove_value_fun
     }
 };
 
+template<class V>
 inline void ProductModel::remove_value (
-        const Value & value,
+        const V & value,
         rng_t & rng)
 {
     remove_value_fun fun = {features, rng};
     read_value(fun, schema, features, value);
 }
 
+template<class D>
 inline void ProductModel::add_diff (
-        const Value::Diff & diff,
+        const D & diff,
         rng_t & rng)
 {
     add_value(diff.pos(), rng);
 }
 
+template<class D>
 inline void ProductModel::remove_diff (
-        const Value::Diff & diff,
+        const D & diff,
         rng_t & rng)
 {
     remove_value(diff.pos(), rng);
@@ -107,6 +107,70 @@ public:
     const Reals & operator[] (float *) const { return reals; }
 };
 
+//----------------------------------------------------------------------------
+// Flat values
+//
+// FlatValue is an internal sparse form of a partial ProductValue,
+// holding (position, value) pairs of observed features per datatype,
+// with positions relative to the start of that datatype's block and
+// in increasing order.  Storage is reused across rows, so splitting
+// and reading rows allocates nothing once buffers have grown.
+
+struct FlatValue
+{
+    struct Map
+    {
+        template<class T>
+        struct Container
+        {
+            typedef std::vector<std::pair<uint32_t, T>> t;
+        };
+    };
+    typedef ForEachDataType<Map> Fields;
+
+    Fields fields;
+
+    size_t size () const
+    {
+        return fields.booleans.size()
+            + fields.counts.size()
+            + fields.reals.size();
+    }
+
+    void clear ()
+    {
+        fields.booleans.clear();
+        fields.counts.clear();
+        fields.reals.clear();
+    }
+};
+
+class FlatDiff
+{
+public:
+
+    const FlatValue & pos () const { return pos_; }
+    const FlatValue & neg () const { return neg_; }
+    const std::vector<uint32_t> & tares () const { return tares_; }
+
+    FlatValue & pos () { return pos_; }
+    FlatValue & neg () { return neg_; }
+    std::vector<uint32_t> & tares () { return tares_; }
+
+    void clear ()
+    {
+        pos_.clear();
+        neg_.clear();
+        tares_.clear();
+    }
+
+private:
+
+    FlatValue pos_;
+    FlatValue neg_;
+    std::vector<uint32_t> tares_;
+};
+
 //----------------------------------------------------------------------------
 // Schema
 
@@ -170,6 +234,11 @@ struct ValueSchema
             + value.reals_size();
     }
 
+    static size_t total_size (const FlatValue & value)
+    {
+        return value.size();
+    }
+
     void clear ()
     {
         booleans_size = 0;
@@ -373,6 +442,35 @@ struct ValueSchema
             "diff has neg parts but no tares");
     }
 
+    void validate (const FlatValue & value) const
+    {
+        validate(value.fields.booleans, booleans_size);
+        validate(value.fields.counts, counts_size);
+        validate(value.fields.reals, reals_size);
+    }
+
+    template<class T>
+    static void validate (
+            const std::vector<std::pair<uint32_t, T>> & field,
+            size_t size)
+    {
+        for (size_t i = 0; i < field.size(); ++i) {
+            LOOM_ASSERT_LT(field[i].first, size);
+            if (i) {
+                LOOM_ASSERT_LT(field[i - 1].first, field[i].first);
+            }
+        }
+    }
+
+    void validate (const FlatDiff & diff) const
+    {
+        validate(diff.pos());
+        validate(diff.neg());
+        LOOM_ASSERT(
+            diff.tares().size() or not diff.neg().size(),
+            "diff has neg parts but no tares");
+    }
+
     bool is_valid (const ProductValue::Diff & diff) const
     {
         return is_valid(diff.pos())
@@ -767,6 +865,48 @@ inline void read_value (
     }
 }
 
+template<class Feature, class Fun>
+inline void read_value (
+        Fun & fun,
+        const ValueSchema & value_schema,
+        const ForEachFeatureType<Feature> & model_schema,
+        const FlatValue & value)
+{
+    if (LOOM_DEBUG_LEVEL >= 2) {
+        value_schema.validate(model_schema);
+        value_schema.validate(value);
+    }
+
+    for (const auto & pair : value.fields.booleans) {
+        fun(BB::null(), pair.first, pair.second);
+    }
+    {
+        auto i = value.fields.counts.begin();
+        const auto end = value.fields.counts.end();
+        BlockIterator block;
+        for (block(model_schema.dd16.size());
+                i != end and block.ok(i->first); ++i) {
+            fun(DD16::null(), block.get(i->first), i->second);
+        }
+        for (block(model_schema.dd256.size());
+                i != end and block.ok(i->first); ++i) {
+            fun(DD256::null(), block.get(i->first), i->second);
+        }
+        for (block(model_schema.dpd.size());
+                i != end and block.ok(i->first); ++i) {
+            fun(DPD::null(), block.get(i->first), i->second);
+        }
+        for (block(model_schema.gp.size());
+                i != end and block.ok(i->first); ++i) {
+            fun(GP::null(), block.get(i->first), i->second);
+        }
+        LOOM_ASSERT2(i == end, "programmer error");
+    }
+    for (const auto & pair : value.fields.reals) {
+        fun(NICH::null(), pair.first, pair.second);
+    }
+}
+
 //----------------------------------------------------------------------------
 // Write
 
@@ -964,6 +1104,10 @@ struct ValueSplitter : noncopyable
             const ProductValue::Diff & full_diff,
             std::vector<ProductValue::Diff> & partial_diffs) const;
 
+    void split (
+            const ProductValue::Diff & full_diff,
+            std::vector<FlatDiff> & partial_diffs) const;
+
     void join (
             ProductValue & full_value,
             const std::vector<ProductValue> & partial_values) const;
@@ -998,6 +1142,12 @@ private:
     void validate (
             const std::vector<const ProductValue *> & partial_values) const;
 
+    template<class GetPart>
+    void split_flat (
+            const ProductValue & full_value,
+            std::vector<FlatDiff> & partial_diffs,
+            const GetPart & get_part) const;
+
     struct split_value_all_fun;
     struct split_value_dense_fun;
     struct split_value_sparse_fun;
@@ -1092,6 +1242,69 @@ inline void ValueSplitter::split (
     }
 }
 
+template<class GetPart>
+inline void ValueSplitter::split_flat (
+        const ProductValue & full_value,
+        std::vector<FlatDiff> & partial_diffs,
+        const GetPart & get_part) const
+{
+    validate(full_value);
+    auto booleans = full_value.booleans().begin();
+    auto counts = full_value.counts().begin();
+    auto reals = full_value.reals().begin();
+    const size_t counts_begin = schema_.booleans_size;
+    const size_t reals_begin = counts_begin + schema_.counts_size;
+    schema_.for_each(full_value.observed(), [&](size_t full_pos){
+        const auto partid = full_to_partid_[full_pos];
+        const auto & part_schema = part_schemas_[partid];
+        FlatValue::Fields & part = get_part(partial_diffs[partid]).fields;
+        size_t part_pos = full_to_part_[full_pos];
+        if (full_pos < counts_begin) {
+            part.booleans.push_back(std::make_pair(part_pos, *booleans++));
+        } else if (full_pos < reals_begin) {
+            part_pos -= part_schema.booleans_size;
+            part.counts.push_back(std::make_pair(part_pos, *counts++));
+        } else {
+            part_pos -= part_schema.booleans_size + part_schema.counts_size;
+            part.reals.push_back(std::make_pair(part_pos, *reals++));
+        }
+    });
+    LOOM_ASSERT2(booleans == full_value.booleans().end(), "programmer error");
+    LOOM_ASSERT2(counts == full_value.counts().end(), "programmer error");
+    LOOM_ASSERT2(reals == full_value.reals().end(), "programmer error");
+}
+
+inline void ValueSplitter::split (
+        const ProductValue::Diff & full_diff,
+        std::vector<FlatDiff> & partial_diffs) const
+{
+    try {
+        const size_t part_count = part_schemas_.size();
+        partial_diffs.resize(part_count);
+        for (auto & partial_diff : partial_diffs) {
+            partial_diff.clear();
+        }
+        split_flat(full_diff.pos(), partial_diffs, [](FlatDiff & diff)
+            -> FlatValue & { return diff.pos(); });
+        split_flat(full_diff.neg(), partial_diffs, [](FlatDiff & diff)
+            -> FlatValue & { return diff.neg(); });
+        if (full_diff.tares_size()) {
+            for (auto & partial_diff : partial_diffs) {
+                partial_diff.tares().assign(
+                    full_diff.tares().begin(),
+                    full_diff.tares().end());
+            }
+        }
+        if (LOOM_DEBUG_LEVEL >= 2) {
+            for (size_t i = 0; i < part_count; ++i) {
+                part_schemas_[i].validate(partial_diffs[i]);
+            }
+        }
+    } catch (google::protobuf::FatalException e) {
+        LOOM_ERROR(e.what());
+    }
+}
+
 inline void ValueSplitter::join (
         ProductValue & full_value,
         const std::vector<ProductValue> & partial_values) const
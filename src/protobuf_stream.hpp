@@ -30,12 +30,27 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <memory>
 #include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <zlib.h>
+#ifdef LOOM_USE_ZSTD
+#include <zstd.h>
+#endif // LOOM_USE_ZSTD
 #include <google/protobuf/io/coded_stream.h>
 #include <google/protobuf/io/zero_copy_stream_impl.h>
 #include <google/protobuf/io/gzip_stream.h>
 #include <loom/common.hpp>
+#include <loom/timer.hpp>
 
 namespace loom
 {
@@ -48,16 +63,759 @@ inline bool endswith (const char * filename, const char * suffix)
         strcmp(filename + strlen(filename) - strlen(suffix), suffix) == 0;
 }
 
+// An optional sidecar FILENAME.idx for a message stream, recording the
+// uncompressed byte offset of every stride-th message.  Gzip streams written
+// with an index are split into independent gzip members at these messages,
+// and restarts records the compressed offset where each member begins.
+// An index is ignored if the stream's size or mtime no longer match.
+struct StreamIndex
+{
+    enum { default_stride = 1024 };
+
+    uint64_t data_size;
+    uint64_t data_mtime;
+    uint64_t byte_count;
+    uint64_t message_count;
+    uint32_t max_message_size;
+    uint32_t stride;
+    std::vector<uint64_t> offsets;
+    std::vector<uint64_t> restarts;
+
+    explicit StreamIndex (uint32_t stride_ = default_stride) :
+        data_size(0),
+        data_mtime(0),
+        byte_count(0),
+        message_count(0),
+        max_message_size(0),
+        stride(stride_)
+    {
+        LOOM_ASSERT_LT(0, stride);
+    }
+
+    void add_message (uint32_t message_size)
+    {
+        if (message_count % stride == 0) {
+            offsets.push_back(byte_count);
+        }
+        byte_count += sizeof(uint32_t) + message_size;
+        max_message_size = std::max(max_message_size, message_size);
+        ++message_count;
+    }
+
+    bool try_load (const std::string & filename)
+    {
+        uint64_t size, mtime;
+        if (not _try_stat(filename, size, mtime)) {
+            return false;
+        }
+        FILE * file = fopen((filename + ".idx").c_str(), "rb");
+        if (file == nullptr) {
+            return false;
+        }
+        char header[8];
+        uint64_t offset_count, restart_count;
+        bool success =
+            fread(header, sizeof(header), 1, file) == 1 and
+            memcmp(header, magic(), sizeof(header)) == 0 and
+            _read(file, data_size) and
+            _read(file, data_mtime) and
+            _read(file, byte_count) and
+            _read(file, message_count) and
+            _read(file, max_message_size) and
+            _read(file, stride) and
+            _read(file, offset_count) and
+            _read(file, restart_count) and
+            data_size == size and
+            data_mtime == mtime and
+            stride > 0 and
+            offset_count == (message_count + stride - 1) / stride and
+            restart_count <= offset_count;
+        if (success) {
+            offsets.resize(offset_count);
+            restarts.resize(restart_count);
+            success =
+                fread(offsets.data(), sizeof(uint64_t), offset_count, file)
+                    == offset_count and
+                fread(restarts.data(), sizeof(uint64_t), restart_count, file)
+                    == restart_count;
+        }
+        fclose(file);
+        return success;
+    }
+
+    void dump (const std::string & filename)
+    {
+        bool success = _try_stat(filename, data_size, data_mtime);
+        LOOM_ASSERT(success, "failed to stat " << filename);
+        const std::string index_filename = filename + ".idx";
+        FILE * file = fopen(index_filename.c_str(), "wb");
+        LOOM_ASSERT(file, "failed to open index file " << index_filename);
+        const uint64_t offset_count = offsets.size();
+        const uint64_t restart_count = restarts.size();
+        success =
+            fwrite(magic(), 8, 1, file) == 1 and
+            _write(file, data_size) and
+            _write(file, data_mtime) and
+            _write(file, byte_count) and
+            _write(file, message_count) and
+            _write(file, max_message_size) and
+            _write(file, stride) and
+            _write(file, offset_count) and
+            _write(file, restart_count) and
+            fwrite(offsets.data(), sizeof(uint64_t), offset_count, file)
+                == offset_count and
+            fwrite(restarts.data(), sizeof(uint64_t), restart_count, file)
+                == restart_count;
+        success = (fclose(file) == 0) and success;
+        LOOM_ASSERT(success, "failed to write index file " << index_filename);
+    }
+
+private:
+
+    static const char * magic () { return "LOOMIDX1"; }
+
+    static bool _try_stat (
+            const std::string & filename,
+            uint64_t & size,
+            uint64_t & mtime)
+    {
+        struct stat info;
+        if (stat(filename.c_str(), & info) != 0 or not S_ISREG(info.st_mode)) {
+            return false;
+        }
+        size = info.st_size;
+        mtime = info.st_mtim.tv_sec * 1000000000ULL + info.st_mtim.tv_nsec;
+        return true;
+    }
+
+    template<class T>
+    static bool _read (FILE * file, T & value)
+    {
+        return fread(& value, sizeof(T), 1, file) == 1;
+    }
+
+    template<class T>
+    static bool _write (FILE * file, const T & value)
+    {
+        return fwrite(& value, sizeof(T), 1, file) == 1;
+    }
+};
+
+// A serialized message that has not yet been parsed.
+// When read from a memory-mapped file, data points into the mapping and
+// remains valid for the lifetime of the InFile; when read from a .pbsz file,
+// data points into a decompressed block that is kept alive by block;
+// otherwise data points into the owned buffer.
+struct RawMessage
+{
+    const char * data;
+    uint32_t size;
+    std::vector<char> buffer;
+    std::shared_ptr<const std::vector<char>> block;
+
+    RawMessage () : data(nullptr), size(0) {}
+};
+
+//----------------------------------------------------------------------------
+// Block-compressed streams
+//
+// A .pbsz file is a sequence of independently compressed blocks, each
+// holding a run of length-prefixed messages, followed by a footer and
+// trailer locating each block:
+//
+//   block:   codec (uint8), raw size (uint32), data size (uint32), data
+//   footer:  for each block, file offset (uint64), first message (uint64)
+//   trailer: footer offset (uint64), block count (uint64),
+//            message count (uint64), max message size (uint32),
+//            magic "LOOMPBSZ"
+//
+// Blocks can be located in O(log(block_count)) and decompressed in parallel.
+// Writers end a block after block_size messages or before it would exceed
+// max_block_bytes, so that sizes fit in the uint32 header fields.
+
+struct BlockCodec
+{
+    enum Type : uint8_t { STORED = 0, DEFLATE = 1, ZSTD = 2 };
+
+    enum { header_size = 9, trailer_size = 36 };
+
+    static const char * magic () { return "LOOMPBSZ"; }
+
+    static Type compress (
+            const std::vector<char> & raw,
+            std::vector<char> & compressed)
+    {
+#ifdef LOOM_USE_ZSTD
+        compressed.resize(ZSTD_compressBound(raw.size()));
+        const size_t size = ZSTD_compress(
+            compressed.data(), compressed.size(),
+            raw.data(), raw.size(),
+            3);
+        LOOM_ASSERT(not ZSTD_isError(size), ZSTD_getErrorName(size));
+        const Type type = ZSTD;
+#else // LOOM_USE_ZSTD
+        uLongf size = compressBound(raw.size());
+        compressed.resize(size);
+        int info = compress2(
+            reinterpret_cast<Bytef *>(compressed.data()), & size,
+            reinterpret_cast<const Bytef *>(raw.data()), raw.size(),
+            Z_DEFAULT_COMPRESSION);
+        LOOM_ASSERT_EQ(info, Z_OK);
+        const Type type = DEFLATE;
+#endif // LOOM_USE_ZSTD
+        if (size < raw.size()) {
+            compressed.resize(size);
+            return type;
+        } else {
+            compressed = raw;
+            return STORED;
+        }
+    }
+
+    static void decompress (
+            uint8_t type,
+            const char * data,
+            size_t size,
+            char * raw,
+            size_t raw_size)
+    {
+        switch (type) {
+            case STORED: {
+                LOOM_ASSERT_EQ(size, raw_size);
+                memcpy(raw, data, size);
+            } break;
+
+            case DEFLATE: {
+                uLongf actual_size = raw_size;
+                int info = uncompress(
+                    reinterpret_cast<Bytef *>(raw), & actual_size,
+                    reinterpret_cast<const Bytef *>(data), size);
+                LOOM_ASSERT_EQ(info, Z_OK);
+                LOOM_ASSERT_EQ(actual_size, raw_size);
+            } break;
+
+            case ZSTD: {
+#ifdef LOOM_USE_ZSTD
+                size_t actual_size = ZSTD_decompress(raw, raw_size, data, size);
+                LOOM_ASSERT(
+                    not ZSTD_isError(actual_size),
+                    ZSTD_getErrorName(actual_size));
+                LOOM_ASSERT_EQ(actual_size, raw_size);
+#else // LOOM_USE_ZSTD
+                LOOM_ERROR("loom was built without zstd support");
+#endif // LOOM_USE_ZSTD
+            } break;
+
+            default:
+                LOOM_ERROR("unknown block codec: " << int(type));
+        }
+    }
+
+    static bool pread_all (int fid, void * data, size_t size, uint64_t offset)
+    {
+        char * pos = static_cast<char *>(data);
+        while (size) {
+            ssize_t count = pread(fid, pos, size, offset);
+            if (count <= 0) {
+                return false;
+            }
+            pos += count;
+            size -= count;
+            offset += count;
+        }
+        return true;
+    }
+
+    static void write_all (int fid, const void * data, size_t size)
+    {
+        const char * pos = static_cast<const char *>(data);
+        while (size) {
+            ssize_t count = write(fid, pos, size);
+            LOOM_ASSERT(count > 0, "failed to write block");
+            pos += count;
+            size -= count;
+        }
+    }
+};
+
+class BlockReader : noncopyable
+{
+public:
+
+    typedef std::shared_ptr<const std::vector<char>> Block;
+
+    BlockReader (int fid, const std::string & filename) :
+        fid_(fid),
+        filename_(filename)
+    {
+        struct stat info;
+        LOOM_ASSERT(fstat(fid, & info) == 0, "failed to stat " << filename);
+        LOOM_ASSERT(
+            info.st_size >= BlockCodec::trailer_size,
+            "truncated " << filename);
+        char trailer[BlockCodec::trailer_size];
+        bool success = BlockCodec::pread_all(
+            fid,
+            trailer,
+            sizeof(trailer),
+            info.st_size - sizeof(trailer));
+        LOOM_ASSERT(success, "failed to read " << filename);
+        LOOM_ASSERT(
+            memcmp(trailer + 28, BlockCodec::magic(), 8) == 0,
+            "not a .pbsz file: " << filename);
+        uint64_t block_count;
+        memcpy(& footer_offset_, trailer, 8);
+        memcpy(& block_count, trailer + 8, 8);
+        memcpy(& message_count_, trailer + 16, 8);
+        memcpy(& max_message_size_, trailer + 24, 4);
+
+        std::vector<uint64_t> footer(2 * block_count);
+        success = BlockCodec::pread_all(
+            fid,
+            footer.data(),
+            footer.size() * sizeof(uint64_t),
+            footer_offset_);
+        LOOM_ASSERT(success, "failed to read " << filename);
+        offsets_.resize(block_count);
+        first_messages_.resize(block_count);
+        for (size_t b = 0; b < block_count; ++b) {
+            offsets_[b] = footer[2 * b];
+            first_messages_[b] = footer[2 * b + 1];
+        }
+    }
+
+    size_t block_count () const { return offsets_.size(); }
+    uint64_t message_count () const { return message_count_; }
+    uint32_t max_message_size () const { return max_message_size_; }
+
+    uint64_t first_message (size_t block) const
+    {
+        return first_messages_[block];
+    }
+
+    uint64_t block_offset (size_t block) const
+    {
+        return block < block_count() ? offsets_[block] : footer_offset_;
+    }
+
+    // returns the block containing message, or the last block
+    size_t find_block (uint64_t message) const
+    {
+        LOOM_ASSERT1(block_count(), "stream has no blocks");
+        auto pos = std::upper_bound(
+            first_messages_.begin(),
+            first_messages_.end(),
+            message);
+        return pos - first_messages_.begin() - 1;
+    }
+
+    // this is thread safe, given a per-thread scratch buffer
+    Block read_block (size_t block, std::vector<char> & scratch) const
+    {
+        const uint64_t begin = offsets_[block];
+        const uint64_t end = block + 1 < block_count()
+                           ? offsets_[block + 1]
+                           : footer_offset_;
+        LOOM_ASSERT_LT(begin + BlockCodec::header_size, end);
+        scratch.resize(end - begin);
+        bool success =
+            BlockCodec::pread_all(fid_, scratch.data(), scratch.size(), begin);
+        LOOM_ASSERT(success, "failed to read " << filename_);
+
+        const uint8_t type = scratch[0];
+        uint32_t raw_size, data_size;
+        memcpy(& raw_size, scratch.data() + 1, 4);
+        memcpy(& data_size, scratch.data() + 5, 4);
+        LOOM_ASSERT_EQ(BlockCodec::header_size + data_size, scratch.size());
+
+        auto raw = std::make_shared<std::vector<char>>(raw_size);
+        BlockCodec::decompress(
+            type,
+            scratch.data() + BlockCodec::header_size,
+            data_size,
+            raw->data(),
+            raw_size);
+        return raw;
+    }
+
+private:
+
+    const int fid_;
+    const std::string filename_;
+    uint64_t footer_offset_;
+    uint64_t message_count_;
+    uint32_t max_message_size_;
+    std::vector<uint64_t> offsets_;
+    std::vector<uint64_t> first_messages_;
+};
+
+// Decompresses blocks ahead of a cyclic sequential reader on a thread pool.
+// Blocks are requested in order block, block + 1, ... modulo block_count;
+// requesting any other block discards the read-ahead and restarts there.
+class BlockPrefetcher : noncopyable
+{
+public:
+
+    typedef BlockReader::Block Block;
+
+    BlockPrefetcher (
+            const BlockReader & reader,
+            size_t thread_count,
+            size_t capacity) :
+        reader_(reader),
+        slots_(capacity),
+        generation_(0),
+        start_(0),
+        head_(0),
+        claimed_(0),
+        stopping_(false)
+    {
+        LOOM_ASSERT_LT(0, thread_count);
+        LOOM_ASSERT_LE(thread_count, capacity);
+        LOOM_ASSERT_LT(0, reader_.block_count());
+        for (auto & slot : slots_) {
+            slot.seq = ~0UL;
+        }
+        for (size_t i = 0; i < thread_count; ++i) {
+            threads_.push_back(std::thread(&BlockPrefetcher::_work, this));
+        }
+    }
+
+    ~BlockPrefetcher ()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        work_cond_.notify_all();
+        for (auto & thread : threads_) {
+            thread.join();
+        }
+    }
+
+    size_t thread_count () const { return threads_.size(); }
+
+    Block get (size_t block)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (_block_of(head_) != block) {
+            ++generation_;
+            start_ = block;
+            head_ = 0;
+            claimed_ = 0;
+            for (auto & slot : slots_) {
+                slot.seq = ~0UL;
+                slot.block.reset();
+            }
+            work_cond_.notify_all();
+        }
+        Slot & slot = slots_[head_ % slots_.size()];
+        ready_cond_.wait(lock, [&](){ return slot.seq == head_; });
+        Block result;
+        std::swap(result, slot.block);
+        slot.seq = ~0UL;
+        ++head_;
+        work_cond_.notify_one();
+        return result;
+    }
+
+private:
+
+    struct Slot
+    {
+        uint64_t seq;
+        Block block;
+    };
+
+    size_t _block_of (uint64_t seq) const
+    {
+        return (start_ + seq) % reader_.block_count();
+    }
+
+    void _work ()
+    {
+        std::vector<char> scratch;
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            work_cond_.wait(lock, [&](){
+                return stopping_ or claimed_ < head_ + slots_.size();
+            });
+            if (stopping_) {
+                return;
+            }
+            const uint64_t generation = generation_;
+            const uint64_t seq = claimed_++;
+            const size_t block = _block_of(seq);
+
+            lock.unlock();
+            Block data = reader_.read_block(block, scratch);
+            lock.lock();
+
+            if (generation == generation_) {
+                Slot & slot = slots_[seq % slots_.size()];
+                slot.block = std::move(data);
+                slot.seq = seq;
+                ready_cond_.notify_one();
+            }
+        }
+    }
+
+    const BlockReader & reader_;
+    std::vector<Slot> slots_;
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable work_cond_;
+    std::condition_variable ready_cond_;
+    uint64_t generation_;
+    size_t start_;
+    uint64_t head_;
+    uint64_t claimed_;
+    bool stopping_;
+};
+
+// Warms the page cache over a window of bytes ahead of a reader,
+// so that reads on the reader's thread rarely block on disk.
+// Positions are unwrapped: a cyclic reader passes pos + cycles * file_size,
+// and any backward jump restarts the window at the new position.
+class PagePrefetcher : noncopyable
+{
+public:
+
+    enum { chunk_bytes = 1 << 20 };
+
+    PagePrefetcher (const std::string & filename, uint64_t window_bytes) :
+        window_bytes_(window_bytes),
+        chunk_bytes_(std::min<uint64_t>(chunk_bytes, window_bytes)),
+        published_(0),
+        target_(0),
+        reset_(false),
+        stopping_(false),
+        fetched_bytes_(0),
+        fetch_time_(0)
+    {
+        LOOM_ASSERT_LT(0, window_bytes_);
+        fid_ = open(filename.c_str(), O_RDONLY | O_NOATIME);
+        LOOM_ASSERT(fid_ != -1, "failed to open input file " << filename);
+        struct stat info;
+        LOOM_ASSERT(fstat(fid_, & info) == 0, "failed to stat " << filename);
+        file_size_ = info.st_size;
+        LOOM_ASSERT_LT(0, file_size_);
+        thread_ = std::thread(&PagePrefetcher::_work, this);
+    }
+
+    ~PagePrefetcher ()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cond_.notify_one();
+        thread_.join();
+        close(fid_);
+    }
+
+    uint64_t file_size () const { return file_size_; }
+    uint64_t window_bytes () const { return window_bytes_; }
+
+    // this is called by a single reader thread after each read
+    void advance (uint64_t pos)
+    {
+        if (LOOM_LIKELY(published_ <= pos and pos < published_ + chunk_bytes_)) {
+            return;
+        }
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (pos < published_) {
+                reset_ = true;
+            }
+            target_ = pos;
+        }
+        published_ = pos;
+        cond_.notify_one();
+    }
+
+    // these are called by the logger, and reset on each call
+    uint64_t take_fetched_bytes () { return fetched_bytes_.exchange(0); }
+    usec_t take_fetch_time () { return fetch_time_.exchange(0); }
+
+private:
+
+    void _work ()
+    {
+        std::vector<char> scratch;
+        uint64_t done = 0;
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            cond_.wait(lock, [&](){
+                return stopping_ or reset_ or done < target_ + window_bytes_;
+            });
+            if (stopping_) {
+                return;
+            }
+            if (reset_ or done < target_) {
+                done = target_;
+                reset_ = false;
+            }
+            const uint64_t end =
+                std::min(done + chunk_bytes_, target_ + window_bytes_);
+            lock.unlock();
+            _fetch(done, end - done, scratch);
+            lock.lock();
+            done = end;
+        }
+    }
+
+    void _fetch (uint64_t pos, uint64_t size, std::vector<char> & scratch)
+    {
+        const usec_t start = current_time_usec();
+        fetched_bytes_.fetch_add(size, std::memory_order_relaxed);
+        uint64_t offset = pos % file_size_;
+        while (size) {
+            const uint64_t part = std::min(size, file_size_ - offset);
+            if (readahead(fid_, offset, part) != 0) {
+                // some filesystems do not support readahead
+                scratch.resize(chunk_bytes_);
+                for (uint64_t done = 0; done < part;) {
+                    ssize_t count = pread(
+                        fid_,
+                        scratch.data(),
+                        std::min<uint64_t>(part - done, scratch.size()),
+                        offset + done);
+                    if (count <= 0) {
+                        break;
+                    }
+                    done += count;
+                }
+            }
+            size -= part;
+            offset = 0;
+        }
+        fetch_time_.fetch_add(
+            current_time_usec() - start,
+            std::memory_order_relaxed);
+    }
+
+    const uint64_t window_bytes_;
+    const uint64_t chunk_bytes_;
+    int fid_;
+    uint64_t file_size_;
+    uint64_t published_;
+    uint64_t target_;
+    bool reset_;
+    bool stopping_;
+    std::atomic<uint64_t> fetched_bytes_;
+    std::atomic<usec_t> fetch_time_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::thread thread_;
+};
+
+class BlockWriter : noncopyable
+{
+public:
+
+    enum { default_block_size = 1024 };
+    enum { max_block_bytes = 1 << 26 };
+
+    BlockWriter (int fid, size_t block_size = default_block_size) :
+        fid_(fid),
+        block_size_(block_size),
+        offset_(0),
+        message_count_(0),
+        max_message_size_(0),
+        block_message_count_(0)
+    {
+        LOOM_ASSERT_LT(0, block_size_);
+    }
+
+    // returns a buffer for the caller to serialize the message into
+    char * add_message (uint32_t message_size)
+    {
+        LOOM_ASSERT_LE(message_size, 0xffffffffULL - 4);
+        if (block_message_count_ == block_size_ or
+            (block_message_count_ and
+             raw_.size() + 4 + message_size > max_block_bytes)) {
+            flush();
+        }
+        const size_t pos = raw_.size();
+        raw_.resize(pos + 4 + message_size);
+        google::protobuf::io::CodedOutputStream::WriteLittleEndian32ToArray(
+            message_size,
+            reinterpret_cast<uint8_t *>(& raw_[pos]));
+        max_message_size_ = std::max(max_message_size_, message_size);
+        ++block_message_count_;
+        ++message_count_;
+        return & raw_[pos + 4];
+    }
+
+    void flush ()
+    {
+        if (block_message_count_ == 0) {
+            return;
+        }
+        footer_.push_back(offset_);
+        footer_.push_back(message_count_ - block_message_count_);
+
+        const uint8_t type = BlockCodec::compress(raw_, compressed_);
+        LOOM_ASSERT_LE(raw_.size(), 0xffffffffULL);
+        LOOM_ASSERT_LE(compressed_.size(), 0xffffffffULL);
+        char header[BlockCodec::header_size];
+        const uint32_t raw_size = raw_.size();
+        const uint32_t data_size = compressed_.size();
+        header[0] = type;
+        memcpy(header + 1, & raw_size, 4);
+        memcpy(header + 5, & data_size, 4);
+        BlockCodec::write_all(fid_, header, sizeof(header));
+        BlockCodec::write_all(fid_, compressed_.data(), data_size);
+        offset_ += sizeof(header) + data_size;
+
+        raw_.clear();
+        block_message_count_ = 0;
+    }
+
+    void close ()
+    {
+        flush();
+        const uint64_t block_count = footer_.size() / 2;
+        BlockCodec::write_all(
+            fid_,
+            footer_.data(),
+            footer_.size() * sizeof(uint64_t));
+        char trailer[BlockCodec::trailer_size];
+        memcpy(trailer, & offset_, 8);
+        memcpy(trailer + 8, & block_count, 8);
+        memcpy(trailer + 16, & message_count_, 8);
+        memcpy(trailer + 24, & max_message_size_, 4);
+        memcpy(trailer + 28, BlockCodec::magic(), 8);
+        BlockCodec::write_all(fid_, trailer, sizeof(trailer));
+    }
+
+private:
+
+    const int fid_;
+    const size_t block_size_;
+    uint64_t offset_;
+    uint64_t message_count_;
+    uint32_t max_message_size_;
+    size_t block_message_count_;
+    std::vector<char> raw_;
+    std::vector<char> compressed_;
+    std::vector<uint64_t> footer_;
+};
+
 class InFile : noncopyable
 {
 public:
 
-    InFile (int fid) : fid_(fid)
+    InFile (int fid) : fid_(fid), cycle_offset_(0), index_checked_(false)
     {
         _open();
     }
 
-    InFile (const char * filename) : filename_(filename)
+    InFile (const char * filename) :
+        filename_(filename),
+        cycle_offset_(0),
+        index_checked_(false)
     {
         LOOM_ASSERT(not filename_.empty(), "empty filename is not supported");
         _open();
@@ -73,11 +831,100 @@ public:
 
     uint64_t position () const { return position_; }
 
+    bool is_mapped () const { return map_begin_ != nullptr; }
+    bool is_blocked () const { return blocks_ != nullptr; }
+
+    // Block-compressed files are decompressed ahead of the reader
+    // on unzip_threads threads; other formats read on the caller's thread.
+    void set_unzip_threads (size_t unzip_threads)
+    {
+        if (not is_blocked() or blocks_->block_count() == 0) {
+            return;
+        }
+        if (unzip_threads == 0) {
+            prefetcher_.reset();
+        } else if (not prefetcher_ or
+                   prefetcher_->thread_count() != unzip_threads) {
+            prefetcher_.reset();
+            const size_t capacity = 2 * unzip_threads;
+            prefetcher_.reset(
+                new BlockPrefetcher(* blocks_, unzip_threads, capacity));
+        }
+    }
+
+    // Regular files are read ahead into the page cache by a background
+    // thread, keeping prefetch_bytes ahead of the reader.
+    void set_prefetch_bytes (uint64_t prefetch_bytes)
+    {
+        if (not is_file_) {
+            return;
+        }
+        if (prefetch_bytes == 0) {
+            page_prefetcher_.reset();
+        } else if (not page_prefetcher_ or
+                   page_prefetcher_->window_bytes() != prefetch_bytes) {
+            page_prefetcher_.reset();
+            struct stat info;
+            if (fstat(fid_, & info) == 0 and
+                S_ISREG(info.st_mode) and
+                info.st_size > 0) {
+                page_prefetcher_.reset(
+                    new PagePrefetcher(filename_, prefetch_bytes));
+                cycle_offset_ = 0;
+                _advance();
+            }
+        }
+    }
+
+    PagePrefetcher * page_prefetcher () { return page_prefetcher_.get(); }
+
+    // returns the stream's index sidecar, or nullptr if none is available
+    const StreamIndex * index ()
+    {
+        if (not index_checked_) {
+            index_checked_ = true;
+            if (is_file_ and not is_blocked()) {
+                index_.reset(new StreamIndex());
+                if (not index_->try_load(filename_)) {
+                    index_.reset();
+                }
+            }
+        }
+        return index_.get();
+    }
+
     void set_position (uint64_t target)
     {
-        if (target < position_) {
-            _close();
-            _open();
+        if (is_blocked()) {
+            LOOM_ASSERT_LE(target, blocks_->message_count());
+            if (target != position_ and blocks_->block_count()) {
+                const size_t block = blocks_->find_block(target);
+                if (target < position_ or block + 1 != next_block_) {
+                    _load_block(block);
+                    position_ = blocks_->first_message(block);
+                }
+            }
+        } else if (const StreamIndex * index = this->index()) {
+            LOOM_ASSERT_LE(target, index->message_count);
+            const size_t block = std::min(
+                target / index->stride,
+                index->offsets.size() - 1);
+            const uint64_t block_position = block * index->stride;
+            if (target < position_ or position_ < block_position) {
+                _seek(* index, block);
+            }
+        } else if (target < position_) {
+            _rewind();
+        }
+
+        if (_is_buffered()) {
+            const char * data;
+            uint32_t size;
+            while (position_ < target) {
+                bool success = _try_read_buffered(data, size);
+                LOOM_ASSERT(success, "failed to set position of " << filename_);
+            }
+            return;
         }
 
         while (position_ < target) {
@@ -89,18 +936,39 @@ public:
             LOOM_ASSERT(success, "failed to set position of " << filename_);
             ++position_;
         }
+        _advance();
     }
 
     template<class Message>
     void read (Message & message)
     {
-        bool success = message.ParseFromZeroCopyStream(stream_);
+        LOOM_ASSERT(not is_blocked(), "cannot read message from " << filename_);
+        bool success;
+        if (is_mapped()) {
+            success = message.ParseFromArray(pos_, end_ - pos_);
+            pos_ = end_;
+        } else {
+            success = message.ParseFromZeroCopyStream(stream_);
+        }
         LOOM_ASSERT(success, "failed to parse message from " << filename_);
     }
 
     template<class Message>
     bool try_read_stream (Message & message)
     {
+        if (_is_buffered()) {
+            const char * data;
+            uint32_t size;
+            if (LOOM_LIKELY(_try_read_buffered(data, size))) {
+                bool success = message.ParseFromArray(data, size);
+                LOOM_ASSERT(success,
+                    "failed to parse message from " << filename_);
+                return true;
+            } else {
+                return false;
+            }
+        }
+
         google::protobuf::io::CodedInputStream coded(stream_);
         uint32_t message_size = 0;
         if (LOOM_LIKELY(coded.ReadLittleEndian32(& message_size))) {
@@ -109,6 +977,7 @@ public:
             LOOM_ASSERT(success, "failed to parse message from " << filename_);
             coded.PopLimit(old_limit);
             ++position_;
+            _advance();
             return true;
         } else {
             return false;
@@ -117,6 +986,17 @@ public:
 
     bool try_read_stream (std::vector<char> & raw)
     {
+        if (_is_buffered()) {
+            const char * data;
+            uint32_t size;
+            if (LOOM_LIKELY(_try_read_buffered(data, size))) {
+                raw.assign(data, data + size);
+                return true;
+            } else {
+                return false;
+            }
+        }
+
         google::protobuf::io::CodedInputStream coded(stream_);
         uint32_t message_size = 0;
         if (LOOM_LIKELY(coded.ReadLittleEndian32(& message_size))) {
@@ -126,6 +1006,27 @@ public:
             LOOM_ASSERT(success, "failed to parse message from " << filename_);
             coded.PopLimit(old_limit);
             ++position_;
+            _advance();
+            return true;
+        } else {
+            return false;
+        }
+    }
+
+    bool try_read_stream (RawMessage & raw)
+    {
+        if (_is_buffered()) {
+            if (LOOM_LIKELY(_try_read_buffered(raw.data, raw.size))) {
+                if (is_blocked() and raw.block != block_) {
+                    raw.block = block_;
+                }
+                return true;
+            } else {
+                return false;
+            }
+        } else if (LOOM_LIKELY(try_read_stream(raw.buffer))) {
+            raw.data = raw.buffer.data();
+            raw.size = raw.buffer.size();
             return true;
         } else {
             return false;
@@ -137,8 +1038,10 @@ public:
     {
         LOOM_ASSERT2(is_file(), "only files support cyclic_read_stream");
         if (LOOM_UNLIKELY(not try_read_stream(message))) {
-            _close();
-            _open();
+            _rewind();
+            if (page_prefetcher_) {
+                cycle_offset_ += page_prefetcher_->file_size();
+            }
             bool success = try_read_stream(message);
             LOOM_ASSERT(success, "stream is empty");
         }
@@ -160,6 +1063,28 @@ public:
         stats.message_count = 0;
         stats.max_message_size = 0;
 
+        if (file.is_blocked()) {
+            stats.message_count = file.blocks_->message_count();
+            stats.max_message_size = file.blocks_->max_message_size();
+            return stats;
+        }
+
+        if (const StreamIndex * index = file.index()) {
+            stats.message_count = index->message_count;
+            stats.max_message_size = index->max_message_size;
+            return stats;
+        }
+
+        if (file.is_mapped()) {
+            const char * data;
+            uint32_t size;
+            while (file._try_read_buffered(data, size)) {
+                ++stats.message_count;
+                stats.max_message_size = std::max(stats.max_message_size, size);
+            }
+            return stats;
+        }
+
         while (true) {
             google::protobuf::io::CodedInputStream coded(file.stream_);
             uint32_t message_size = 0;
@@ -191,7 +1116,32 @@ private:
             LOOM_ASSERT(fid_ != -1, "failed to open input file " << filename_);
         }
 
+        position_ = 0;
+        stream_offset_ = 0;
+        map_begin_ = pos_ = end_ = nullptr;
+        file_ = nullptr;
+        gzip_ = nullptr;
+        stream_ = nullptr;
+
+        if (endswith(filename_.c_str(), ".pbsz")) {
+            LOOM_ASSERT(is_file_, ".pbsz streams must be files");
+            if (not blocks_) {
+                blocks_.reset(new BlockReader(fid_, filename_));
+            }
+            next_block_ = 0;
+        } else if (is_file_ and not endswith(filename_.c_str(), ".gz")) {
+            if (not _map()) {
+                _open_streams();
+            }
+        } else {
+            _open_streams();
+        }
+    }
+
+    void _open_streams ()
+    {
         file_ = new google::protobuf::io::FileInputStream(fid_);
+        stream_offset_ = 0;
 
         if (endswith(filename_.c_str(), ".gz")) {
             gzip_ = new google::protobuf::io::GzipInputStream(file_);
@@ -200,14 +1150,151 @@ private:
             gzip_ = nullptr;
             stream_ = file_;
         }
+    }
+
+    void _close_streams ()
+    {
+        delete gzip_;
+        delete file_;
+        gzip_ = nullptr;
+        file_ = nullptr;
+    }
+
+    // moves to the first message of an indexed block
+    void _seek (const StreamIndex & index, size_t block)
+    {
+        const uint64_t offset = index.offsets[block];
+        if (is_mapped()) {
+            pos_ = map_begin_ + offset;
+        } else if (gzip_ == nullptr or block < index.restarts.size()) {
+            const uint64_t file_offset = gzip_ ? index.restarts[block] : offset;
+            _close_streams();
+            off_t pos = lseek(fid_, file_offset, SEEK_SET);
+            LOOM_ASSERT(pos != -1, "failed to seek in " << filename_);
+            _open_streams();
+            stream_offset_ = file_offset;
+        } else {
+            // without restart points, gzip streams can only skip bytes
+            // forward from the start of the stream
+            if (position_) {
+                if (position_ < block * index.stride) {
+                    return;
+                }
+                _rewind();
+            }
+            const uint64_t max_skip = 1UL << 30;
+            for (uint64_t remaining = offset; remaining;) {
+                const uint64_t skip = std::min(remaining, max_skip);
+                google::protobuf::io::CodedInputStream coded(stream_);
+                bool success = coded.Skip(skip);
+                LOOM_ASSERT(success, "failed to seek in " << filename_);
+                remaining -= skip;
+            }
+        }
+        position_ = block * index.stride;
+    }
+
+    // uncompressed regular files are read directly out of the page cache
+    bool _map ()
+    {
+        struct stat info;
+        if (fstat(fid_, & info) != 0 or
+            not S_ISREG(info.st_mode) or
+            info.st_size == 0) {
+            return false;
+        }
+
+        const size_t size = info.st_size;
+        void * addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fid_, 0);
+        if (addr == MAP_FAILED) {
+            return false;
+        }
+        madvise(addr, size, MADV_SEQUENTIAL);
+
+        map_begin_ = static_cast<const char *>(addr);
+        pos_ = map_begin_;
+        end_ = map_begin_ + size;
+        return true;
+    }
+
+    bool _load_block (size_t block)
+    {
+        if (block >= blocks_->block_count()) {
+            return false;
+        }
+        block_ = prefetcher_
+               ? prefetcher_->get(block)
+               : blocks_->read_block(block, scratch_);
+        pos_ = block_->data();
+        end_ = pos_ + block_->size();
+        next_block_ = block + 1;
+        return true;
+    }
+
+    bool _is_buffered () const { return is_mapped() or is_blocked(); }
+
+    bool _try_read_buffered (const char * & data, uint32_t & size)
+    {
+        if (LOOM_UNLIKELY(end_ - pos_ < 4)) {
+            LOOM_ASSERT(pos_ == end_, "truncated " << filename_);
+            if (not (is_blocked() and _load_block(next_block_))) {
+                return false;
+            }
+        }
+        google::protobuf::io::CodedInputStream::ReadLittleEndian32FromArray(
+            reinterpret_cast<const uint8_t *>(pos_),
+            & size);
+        data = pos_ + 4;
+        LOOM_ASSERT(size <= end_ - data, "truncated " << filename_);
+        pos_ = data + size;
+        ++position_;
+        _advance();
+        return true;
+    }
+
+    // this is approximate for streams, which buffer ahead of the reader
+    uint64_t _file_offset () const
+    {
+        if (is_mapped()) {
+            return pos_ - map_begin_;
+        } else if (is_blocked()) {
+            return blocks_->block_offset(next_block_);
+        } else {
+            return stream_offset_ + file_->ByteCount();
+        }
+    }
 
+    void _advance ()
+    {
+        if (page_prefetcher_) {
+            page_prefetcher_->advance(cycle_offset_ + _file_offset());
+        }
+    }
+
+    // mapped and blocked files rewind in place,
+    // so that outstanding RawMessages stay valid
+    void _rewind ()
+    {
+        if (is_mapped()) {
+            pos_ = map_begin_;
+        } else if (is_blocked()) {
+            block_.reset();
+            pos_ = end_ = nullptr;
+            next_block_ = 0;
+        } else {
+            _close();
+            _open();
+        }
         position_ = 0;
     }
 
     void _close ()
     {
-        delete gzip_;
-        delete file_;
+        prefetcher_.reset();
+        if (is_mapped()) {
+            munmap(const_cast<char *>(map_begin_), end_ - map_begin_);
+        }
+        _close_streams();
         if (is_file()) {
             close(fid_);
         }
@@ -219,7 +1306,20 @@ private:
     google::protobuf::io::FileInputStream * file_;
     google::protobuf::io::GzipInputStream * gzip_;
     google::protobuf::io::ZeroCopyInputStream * stream_;
+    const char * map_begin_;
+    const char * pos_;
+    const char * end_;
+    uint64_t stream_offset_;
+    uint64_t cycle_offset_;
+    std::unique_ptr<PagePrefetcher> page_prefetcher_;
+    std::unique_ptr<BlockReader> blocks_;
+    std::unique_ptr<BlockPrefetcher> prefetcher_;
+    BlockReader::Block block_;
+    size_t next_block_;
+    std::vector<char> scratch_;
     uint64_t position_;
+    std::unique_ptr<StreamIndex> index_;
+    bool index_checked_;
 };
 
 
@@ -242,20 +1342,43 @@ public:
 
     ~OutFile ()
     {
+        if (blocks_) {
+            blocks_->close();
+        }
         delete gzip_;
         delete file_;
         if (is_file()) {
             close(fid_);
         }
+        if (index_) {
+            index_->dump(filename_);
+        }
     }
 
     const char * filename () const { return filename_.c_str(); }
     bool is_file () const { return is_file_; }
 
+    // Writes an index sidecar when the file is closed.
+    // This must be called before writing any messages,
+    // and has no effect on stdout or appended files.
+    // Block-compressed files are already indexed.
+    void enable_index (uint32_t stride = StreamIndex::default_stride)
+    {
+        LOOM_ASSERT(not index_, "index is already enabled");
+        if (blocks_) {
+            return;
+        }
+        LOOM_ASSERT_EQ(stream_->ByteCount(), 0);
+        if (is_file() and not (flags_ & APPEND)) {
+            index_.reset(new StreamIndex(stride));
+        }
+    }
+
     template<class Message>
     void write (Message & message)
     {
         LOOM_ASSERT1(message.IsInitialized(), "message not initialized");
+        LOOM_ASSERT(not blocks_, "cannot write message to " << filename_);
         bool success = message.SerializeToZeroCopyStream(stream_);
         LOOM_ASSERT(success, "failed to serialize message to " << filename_);
     }
@@ -263,22 +1386,47 @@ public:
     template<class Message>
     void write_stream (Message & message)
     {
-        google::protobuf::io::CodedOutputStream coded(stream_);
         LOOM_ASSERT1(message.IsInitialized(), "message not initialized");
         uint32_t message_size = message.ByteSize();
+        if (blocks_) {
+            char * data = blocks_->add_message(message_size);
+            message.SerializeWithCachedSizesToArray(
+                reinterpret_cast<uint8_t *>(data));
+            return;
+        }
+        if (index_) {
+            _index_message(message_size);
+        }
+        google::protobuf::io::CodedOutputStream coded(stream_);
         coded.WriteLittleEndian32(message_size);
         message.SerializeWithCachedSizes(& coded);
     }
 
     void write_stream (const std::vector<char> & raw)
     {
+        write_stream(raw.data(), raw.size());
+    }
+
+    void write_stream (const char * data, uint32_t size)
+    {
+        if (blocks_) {
+            memcpy(blocks_->add_message(size), data, size);
+            return;
+        }
+        if (index_) {
+            _index_message(size);
+        }
         google::protobuf::io::CodedOutputStream coded(stream_);
-        coded.WriteLittleEndian32(raw.size());
-        coded.WriteRaw(raw.data(), raw.size());
+        coded.WriteLittleEndian32(size);
+        coded.WriteRaw(data, size);
     }
 
     void flush ()
     {
+        if (blocks_) {
+            blocks_->flush();
+            return;
+        }
         if (gzip_) {
             gzip_->Flush();
         }
@@ -301,6 +1449,16 @@ private:
                 O_WRONLY | O_CREAT | O_TRUNC | flags, 0664);
             LOOM_ASSERT(fid_ != -1, "failed to open output file " << filename_);
         }
+        flags_ = flags;
+
+        if (endswith(filename_.c_str(), ".pbsz")) {
+            LOOM_ASSERT(not (flags & APPEND), "cannot append to " << filename_);
+            blocks_.reset(new BlockWriter(fid_));
+            file_ = nullptr;
+            gzip_ = nullptr;
+            stream_ = nullptr;
+            return;
+        }
 
         file_ = new google::protobuf::io::FileOutputStream(fid_);
 
@@ -313,12 +1471,32 @@ private:
         }
     }
 
+    // gzip streams start a new gzip member at each indexed message,
+    // so that readers can seek to it without decompressing the prefix
+    void _index_message (uint32_t message_size)
+    {
+        if (gzip_ and index_->message_count % index_->stride == 0) {
+            if (index_->message_count) {
+                bool success = gzip_->Close();
+                LOOM_ASSERT(success, "failed to compress " << filename_);
+                delete gzip_;
+                gzip_ = new google::protobuf::io::GzipOutputStream(file_);
+                stream_ = gzip_;
+            }
+            index_->restarts.push_back(file_->ByteCount());
+        }
+        index_->add_message(message_size);
+    }
+
     const std::string filename_;
     int fid_;
+    int flags_;
     bool is_file_;
     google::protobuf::io::FileOutputStream * file_;
     google::protobuf::io::GzipOutputStream * gzip_;
     google::protobuf::io::ZeroCopyOutputStream * stream_;
+    std::unique_ptr<BlockWriter> blocks_;
+    std::unique_ptr<StreamIndex> index_;
 };
 
 } // namespace protobuf
@@ -0,0 +1,452 @@
+// Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+// Copyright (c) 2015, Google, Inc.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// - Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// - Neither the name of Salesforce.com nor the names of its contributors
+//   may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+// OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+// TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <thread>
+#include <loom/common.hpp>
+#include <loom/cross_cat.hpp>
+#include <loom/assignments.hpp>
+#include <loom/stream_interval.hpp>
+#include <loom/pipeline.hpp>
+#include <loom/topology.hpp>
+#include <loom/load_balancer.hpp>
+
+namespace loom
+{
+
+// RowPipeline streams rows through unzip, parse and add/remove stages,
+// in micro-batches of rows per task.  The add/remove stage runs either
+// one thread per kind or a pool of workers sharing kinds, optionally
+// pinned to cpus.  Kernel-specific work is done by _process_kind,
+// which each kernel specializes.
+
+template<class Kernel>
+class RowPipeline
+{
+public:
+
+    enum { stage_count = 3 };
+
+    // Config is protobuf::Config::Kernels::Cat or ::Kind
+    template<class Config>
+    RowPipeline (
+            const Config & config,
+            CrossCat & cross_cat,
+            StreamInterval & rows,
+            Assignments & assignments,
+            Kernel & kernel,
+            rng_t & rng);
+
+    ~RowPipeline () { _flush(); }
+
+    void add_row () { _push(true); }
+    void remove_row () { _push(false); }
+
+    void wait ()
+    {
+        _flush();
+        pipeline_.wait();
+        if (balancer_.worker_count()) {
+            _rebalance();
+        }
+        rehome();
+    }
+
+    // Re-places kinds that moved to another numa node or whose mixtures
+    // were rebuilt, e.g. by the hyper kernel, since the last call.
+    void rehome ()
+    {
+        if (pin_threads_) {
+            _rehome();
+        }
+    }
+
+    void log_metrics (Logger::Message & message);
+
+protected:
+
+    struct Row
+    {
+        std::atomic_flag parsed;
+        bool add;
+        protobuf::RawMessage raw;
+        protobuf::Row row;
+        std::vector<FlatDiff> partial_diffs;
+
+        Row () : parsed(ATOMIC_FLAG_INIT) {}
+    };
+
+    // a task carries a micro-batch of rows, in add/remove order
+    struct Task
+    {
+        std::vector<Row> rows;
+        size_t size;
+        bool rehome;
+
+        Task () : rows(), size(0), rehome(false) {}
+    };
+
+    struct ThreadState
+    {
+        rng_t rng;
+        VectorFloat scores;
+    };
+
+    // where a kind's data was last placed, and what its thread must move
+    struct Home
+    {
+        uint64_t stamp;
+        const void * groupids;
+        uint32_t node;
+        bool move_mixture;
+        bool move_groupids;
+
+        Home () :
+            stamp(0),
+            groupids(nullptr),
+            node(~0U),
+            move_mixture(false),
+            move_groupids(false)
+        {
+        }
+    };
+
+    void _push (bool add)
+    {
+        pending_.push_back(add);
+        if (LOOM_UNLIKELY(pending_.size() == rows_per_task_)) {
+            _flush();
+        }
+    }
+
+    void _flush ();
+    void _rehome ();
+    bool _rebalance ();
+    void _rehome_kind (size_t i);
+    void _process_kind (size_t i, const Task & task, ThreadState & thread);
+
+    size_t _thread_index (size_t kindid) const
+    {
+        return balancer_.worker_count() ? balancer_.owner(kindid) : kindid;
+    }
+
+    template<class Fun>
+    void add_thread (size_t stage_number, const Fun & fun);
+
+    void start_threads (size_t parser_threads);
+    void start_kind_threads ();
+    void stop_dead_kind_threads ();
+    void start_worker_threads ();
+
+    const size_t rows_per_task_;
+    std::vector<bool> pending_;
+    const bool pin_threads_;
+    Topology topology_;
+    std::vector<Home> homes_;
+    LoadBalancer balancer_;
+    Pipeline<Task, ThreadState> pipeline_;
+    CrossCat & cross_cat_;
+    StreamInterval & rows_;
+    Assignments & assignments_;
+    Kernel & kernel_;
+    size_t kind_count_;
+    rng_t & rng_;
+};
+
+template<class Kernel>
+template<class Config>
+RowPipeline<Kernel>::RowPipeline (
+        const Config & config,
+        CrossCat & cross_cat,
+        StreamInterval & rows,
+        Assignments & assignments,
+        Kernel & kernel,
+        rng_t & rng) :
+    rows_per_task_(std::max(1U, config.rows_per_task())),
+    pending_(),
+    pin_threads_(config.pin_threads()),
+    topology_(),
+    homes_(),
+    balancer_(config.worker_threads()),
+    pipeline_(
+        config.row_queue_capacity(),
+        stage_count,
+        PipelineGuard::Strategy(config.wait_strategy())),
+    cross_cat_(cross_cat),
+    rows_(rows),
+    assignments_(assignments),
+    kernel_(kernel),
+    kind_count_(0),
+    rng_(rng)
+{
+    rows_.set_unzip_threads(config.unzip_threads());
+    rows_.set_prefetch_bytes(config.prefetch_bytes());
+    pending_.reserve(rows_per_task_);
+    start_threads(config.parser_threads());
+    rehome();
+}
+
+template<class Kernel>
+void RowPipeline<Kernel>::_flush ()
+{
+    if (not pending_.empty()) {
+        const size_t rows_per_task = rows_per_task_;
+        const std::vector<bool> & pending = pending_;
+        pipeline_.start([rows_per_task, &pending](Task & task){
+            if (LOOM_UNLIKELY(task.rows.empty())) {
+                task.rows = std::vector<Row>(rows_per_task);
+            }
+            task.size = pending.size();
+            task.rehome = false;
+            for (size_t r = 0; r < task.size; ++r) {
+                task.rows[r].add = pending[r];
+            }
+        });
+        pending_.clear();
+    }
+}
+
+// Pins each kind thread to a cpu and moves kind data onto the cpu's numa
+// node, via an empty task that each kind thread handles by first-touching
+// its own data.  Mixtures move when rebuilt or reassigned to another node.
+// Assignment queues are large, so they move only when new or reassigned,
+// and only if their pages are not already on the node.
+template<class Kernel>
+void RowPipeline<Kernel>::_rehome ()
+{
+    const bool numa = topology_.node_count() > 1;
+    const size_t kind_count = cross_cat_.kinds.size();
+    homes_.resize(kind_count);
+    bool changed = false;
+    for (size_t i = 0; i < kind_count; ++i) {
+        Home & home = homes_[i];
+        const uint32_t node = topology_.place(_thread_index(i)).node;
+        const uint64_t stamp = cross_cat_.kinds[i].mixture.storage_stamp;
+        const void * groupids = assignments_.groupids(i).data();
+        const bool moved = (node != home.node);
+        home.move_mixture = numa and (moved or stamp != home.stamp);
+        home.move_groupids = numa and (moved or groupids != home.groupids);
+        changed = changed or moved or stamp != home.stamp;
+        home.node = node;
+    }
+
+    if (changed) {
+        _flush();
+        pipeline_.start([](Task & task){
+            task.size = 0;
+            task.rehome = true;
+        });
+        pipeline_.wait();
+        for (size_t i = 0; i < kind_count; ++i) {
+            Home & home = homes_[i];
+            home.stamp = cross_cat_.kinds[i].mixture.storage_stamp;
+            home.groupids = assignments_.groupids(i).data();
+        }
+    }
+}
+
+template<class Kernel>
+void RowPipeline<Kernel>::log_metrics (Logger::Message & message)
+{
+    if (balancer_.worker_count()) {
+        auto & status = * message.mutable_kernel_status();
+        balancer_.log_metrics(* status.mutable_workers());
+    }
+    if (pin_threads_) {
+        // owners are as of the last rebalance, which wait() rehomed
+        auto & placement = * message.mutable_placement();
+        for (size_t i = 0; i < cross_cat_.kinds.size(); ++i) {
+            const auto & cpu = topology_.place(_thread_index(i));
+            placement.add_kind_cpus(cpu.cpu);
+            placement.add_kind_nodes(cpu.node);
+        }
+    }
+}
+
+template<class Kernel>
+bool RowPipeline<Kernel>::_rebalance ()
+{
+    return balancer_.rebalance(cross_cat_.kinds.size(), [this](size_t i){
+        return cross_cat_.kinds[i].featureids.size() + 1.0;
+    });
+}
+
+template<class Kernel>
+inline void RowPipeline<Kernel>::_rehome_kind (size_t i)
+{
+    const Home & home = homes_[i];
+    if (home.move_mixture) {
+        first_touch(cross_cat_.kinds[i].mixture);
+    }
+    if (home.move_groupids) {
+        auto & groupids = assignments_.groupids(i);
+        const void * data = groupids.data();
+        const size_t bytes = groupids.memory_bytes();
+        if (Topology::may_be_off_node(data, bytes, home.node)) {
+            first_touch(groupids);
+        }
+    }
+}
+
+template<class Kernel>
+template<class Fun>
+inline void RowPipeline<Kernel>::add_thread (
+        size_t stage_number,
+        const Fun & fun)
+{
+    ThreadState thread;
+    thread.rng.seed(rng_());
+    pipeline_.unsafe_add_thread(stage_number, thread, fun);
+}
+
+template<class Kernel>
+void RowPipeline<Kernel>::start_threads (size_t parser_threads)
+{
+    // unzip
+    add_thread(0, [this](Task & task, const ThreadState &){
+        for (size_t r = 0; r < task.size; ++r) {
+            Row & row = task.rows[r];
+            if (row.add) {
+                row.parsed.clear();
+                rows_.read_unassigned(row.raw);
+            }
+        }
+    });
+    add_thread(0, [this](Task & task, const ThreadState &){
+        for (size_t r = 0; r < task.size; ++r) {
+            Row & row = task.rows[r];
+            if (not row.add) {
+                row.parsed.clear();
+                rows_.read_assigned(row.raw);
+            }
+        }
+    });
+
+    // parse
+    LOOM_ASSERT_LT(0, parser_threads);
+    for (size_t i = 0; i < parser_threads; ++i) {
+        add_thread(1, [i, this](Task & task, ThreadState &){
+            // parser threads start at staggered rows within a batch
+            for (size_t j = 0; j < task.size; ++j) {
+                Row & row = task.rows[(i + j) % task.size];
+                if (not row.parsed.test_and_set()) {
+                    row.row.ParseFromArray(row.raw.data, row.raw.size);
+                    cross_cat_.splitter.split(
+                        row.row.diff(),
+                        row.partial_diffs);
+                }
+            }
+        });
+    }
+
+    // add/remove
+    auto & rowids = assignments_.rowids();
+    add_thread(2, [&rowids](const Task & task, ThreadState &){
+        for (size_t r = 0; r < task.size; ++r) {
+            const Row & row = task.rows[r];
+            if (row.add) {
+                bool ok = rowids.try_push(row.row.id());
+                LOOM_ASSERT1(ok, "duplicate row: " << row.row.id());
+            } else {
+                const auto rowid = rowids.pop();
+                if (LOOM_DEBUG_LEVEL >= 1) {
+                    LOOM_ASSERT_EQ(rowid, row.row.id());
+                }
+            }
+        }
+    });
+    LOOM_ASSERT(not cross_cat_.kinds.empty(), "no kinds");
+    if (balancer_.worker_count()) {
+        start_worker_threads();
+    } else {
+        start_kind_threads();
+    }
+
+    pipeline_.validate();
+}
+
+template<class Kernel>
+void RowPipeline<Kernel>::start_kind_threads ()
+{
+    while (kind_count_ < cross_cat_.kinds.size()) {
+        size_t i = kind_count_++;
+        const uint32_t cpu = topology_.place(i).cpu;
+
+        // add/remove
+        add_thread(2, [i, cpu, this](const Task & task, ThreadState & thread){
+            if (LOOM_LIKELY(i < cross_cat_.kinds.size())) {
+                if (LOOM_UNLIKELY(task.rehome)) {
+                    Topology::try_pin_current_thread(cpu);
+                    _rehome_kind(i);
+                } else {
+                    _process_kind(i, task, thread);
+                }
+            }
+        });
+    }
+}
+
+// Kind threads were added in order of kindid, and dead kinds have been
+// packed away, so the threads of dead kinds are the most recently added.
+template<class Kernel>
+void RowPipeline<Kernel>::stop_dead_kind_threads ()
+{
+    const size_t kind_count = cross_cat_.kinds.size();
+    if (kind_count < kind_count_) {
+        pipeline_.unsafe_remove_threads(2, kind_count_ - kind_count);
+        kind_count_ = kind_count;
+    }
+}
+
+template<class Kernel>
+void RowPipeline<Kernel>::start_worker_threads ()
+{
+    for (size_t w = 0; w < balancer_.worker_count(); ++w) {
+        const uint32_t cpu = topology_.place(w).cpu;
+
+        // add/remove, several kinds per thread
+        add_thread(2, [w, cpu, this](const Task & task, ThreadState & thread){
+            auto & worker = balancer_.worker(w);
+            if (LOOM_UNLIKELY(task.rehome)) {
+                Topology::try_pin_current_thread(cpu);
+                for (size_t i : worker.taskids) {
+                    _rehome_kind(i);
+                }
+            } else {
+                for (size_t j = 0; j < worker.taskids.size(); ++j) {
+                    TimedScope timer(worker.times[j]);
+                    _process_kind(worker.taskids[j], task, thread);
+                }
+            }
+        });
+    }
+    _rebalance();
+}
+
+} // namespace loom
@@ -38,6 +38,7 @@ const char * help_message =
 "\n  TARGET_MEM_BYTES  target memory usage in bytes"
 "\nNotes:"
 "\n  Any filename can end with .gz to indicate gzip compression."
+"\n  Any stream filename can end with .pbsz to indicate block compression."
 "\n  Any filename can be '-' or '-.gz' to indicate stdin/stdout."
 ;
 
@@ -28,60 +28,223 @@
 
 #pragma once
 
-#include <limits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
 #include <algorithm>
+#include <unistd.h>
 #include <loom/common.hpp>
 #include <loom/protobuf_stream.hpp>
 
 namespace loom
 {
 
+namespace detail
+{
+
+// Shuffling is external and takes two passes:
+// each message is first assigned a random 64-bit key and scattered among
+// bucket files by key range, then each bucket is sorted by key in memory
+// and buckets are concatenated.  Keys depend only on the seed, so the
+// result is a uniformly random permutation that does not depend on the
+// bucket count, while total i/o is two reads and two writes of the data.
+//
+// Keyed messages are stored with their key prepended.
+
+typedef std::vector<char> ShuffleMessage;
+
+enum { max_shuffle_bucket_count = 512 };
+
+inline uint64_t shuffle_key (const ShuffleMessage & keyed)
+{
+    uint64_t key;
+    memcpy(& key, keyed.data(), sizeof(key));
+    return key;
+}
+
+inline void shuffle_add_key (
+        uint64_t key,
+        const ShuffleMessage & message,
+        ShuffleMessage & keyed)
+{
+    keyed.resize(sizeof(key) + message.size());
+    memcpy(keyed.data(), & key, sizeof(key));
+    std::copy(message.begin(), message.end(), keyed.begin() + sizeof(key));
+}
+
+// buckets partition the key space into contiguous ranges
+inline size_t shuffle_bucket_of (uint64_t key, size_t bucket_count)
+{
+    typedef unsigned __int128 uint128_t;
+    return static_cast<size_t>((uint128_t(key) * bucket_count) >> 64);
+}
+
+inline void shuffle_sort (std::vector<ShuffleMessage> & keyed)
+{
+    // ties are broken by input order, which buckets preserve
+    std::stable_sort(
+        keyed.begin(),
+        keyed.end(),
+        [](const ShuffleMessage & x, const ShuffleMessage & y){
+            return shuffle_key(x) < shuffle_key(y);
+        });
+}
+
+inline void shuffle_write (
+        const std::vector<ShuffleMessage> & keyed,
+        protobuf::OutFile & out)
+{
+    const size_t offset = sizeof(uint64_t);
+    for (const auto & message : keyed) {
+        out.write_stream(message.data() + offset, message.size() - offset);
+    }
+}
+
+inline std::string shuffle_temp_dir (const char * shuffled_out)
+{
+    std::string prefix = shuffled_out;
+    if (prefix == "-" or prefix == "-.gz") {
+        const char * tmpdir = getenv("TMPDIR");
+        prefix = std::string(tmpdir ? tmpdir : "/tmp") + "/loom";
+    }
+    std::string dir = prefix + ".shuffle.XXXXXX";
+    LOOM_ASSERT(mkdtemp(& dir[0]), "failed to create temp dir " << dir);
+    return dir;
+}
+
+inline std::string shuffle_bucket_path (const std::string & dir, size_t i)
+{
+    return dir + "/" + std::to_string(i) + ".pbs";
+}
+
+inline void shuffle_bucket (
+        const std::string & path,
+        std::vector<ShuffleMessage> & keyed)
+{
+    keyed.clear();
+    {
+        protobuf::InFile bucket(path.c_str());
+        ShuffleMessage message;
+        while (bucket.try_read_stream(message)) {
+            keyed.push_back(ShuffleMessage());
+            std::swap(message, keyed.back());
+        }
+    }
+    int status = std::remove(path.c_str());
+    LOOM_ASSERT_EQ(status, 0);
+    shuffle_sort(keyed);
+}
+
+} // namespace detail
+
 inline void shuffle_stream (
         const char * messages_in,
         const char * shuffled_out,
         long seed,
         double target_mem_bytes)
 {
-    typedef std::vector<char> Message;
-    typedef uint32_t pos_t;
+    typedef detail::ShuffleMessage Message;
 
     LOOM_ASSERT(
         std::string(messages_in) != std::string(shuffled_out),
         "cannot shuffle file in-place: " << messages_in);
     const auto stats = protobuf::InFile::stream_stats(messages_in);
     LOOM_ASSERT(stats.is_file, "shuffle input is not a file: " << messages_in);
-    const uint64_t max_message_count = std::numeric_limits<pos_t>::max();
-    LOOM_ASSERT(stats.message_count, max_message_count);
-    const size_t message_count = stats.message_count;
-
-    double index_bytes = sizeof(pos_t) * message_count;
-    double target_chunk_size = std::max(1.0, std::min(double(message_count),
-        (target_mem_bytes - index_bytes) / stats.max_message_size));
-    size_t chunk_size = static_cast<size_t>(std::round(target_chunk_size));
-
-    std::vector<pos_t> index(message_count);
-    for (size_t i = 0; i < message_count; ++i) {
-        index[i] = i;
+    const uint64_t message_count = stats.message_count;
+
+    // Ideally one bucket per thread fits in target_mem_bytes.  When the
+    // bucket count is capped, fewer buckets are loaded at once, down to one.
+    const double total_bytes = double(message_count) *
+        (stats.max_message_size + sizeof(uint64_t) + sizeof(Message));
+    const size_t thread_count =
+        std::max(1U, std::thread::hardware_concurrency());
+    size_t bucket_count = 1;
+    size_t wave_size = 1;
+    if (total_bytes > target_mem_bytes) {
+        const double min_bucket_count =
+            std::ceil(total_bytes * thread_count / target_mem_bytes);
+        bucket_count = static_cast<size_t>(std::min(
+            min_bucket_count,
+            double(detail::max_shuffle_bucket_count)));
+        const double bucket_bytes = total_bytes / bucket_count;
+        wave_size = static_cast<size_t>(std::max(1.0, std::min(
+            std::floor(target_mem_bytes / bucket_bytes),
+            double(thread_count))));
+        if (bucket_bytes > target_mem_bytes) {
+            std::cerr << "WARNING shuffle needs ~" << bucket_bytes <<
+                " bytes per bucket, exceeding target_mem_bytes = " <<
+                target_mem_bytes << std::endl;
+        }
     }
-    std::shuffle(index.begin(), index.end(), loom::rng_t(seed));
 
-    Message message;
-    std::vector<Message> chunk;
+    rng_t rng(seed);
+    std::uniform_int_distribution<uint64_t> choose_key;
+
     protobuf::OutFile shuffled(shuffled_out);
-    for (size_t begin = 0; begin < message_count; begin += chunk_size) {
-        size_t end = std::min(begin + chunk_size, message_count);
-        chunk.resize(end - begin);
-        protobuf::InFile messages(messages_in);
-        for (size_t i : index) {
-            messages.try_read_stream(message);
-            if (begin <= i and i < end) {
-                std::swap(message, chunk[i - begin]);
-            }
+    shuffled.enable_index();
+    std::vector<std::vector<Message>> chunks(wave_size);
+
+    if (bucket_count == 1) {
+        auto & keyed = chunks[0];
+        keyed.reserve(message_count);
+        protobuf::InFile in(messages_in);
+        Message message;
+        while (in.try_read_stream(message)) {
+            keyed.push_back(Message());
+            detail::shuffle_add_key(choose_key(rng), message, keyed.back());
+        }
+        detail::shuffle_sort(keyed);
+        detail::shuffle_write(keyed, shuffled);
+        return;
+    }
+
+    // pass 1: scatter messages among buckets by key
+    const std::string temp_dir = detail::shuffle_temp_dir(shuffled_out);
+    {
+        std::vector<std::unique_ptr<protobuf::OutFile>> buckets;
+        for (size_t i = 0; i < bucket_count; ++i) {
+            const auto path = detail::shuffle_bucket_path(temp_dir, i);
+            buckets.emplace_back(new protobuf::OutFile(path.c_str()));
+        }
+        protobuf::InFile in(messages_in);
+        Message message;
+        Message keyed;
+        while (in.try_read_stream(message)) {
+            const uint64_t key = choose_key(rng);
+            detail::shuffle_add_key(key, message, keyed);
+            const Message & raw = keyed;
+            buckets[detail::shuffle_bucket_of(key, bucket_count)]
+                ->write_stream(raw);
+        }
+    }
+
+    // pass 2: sort waves of buckets in parallel, writing them in order
+    for (size_t begin = 0; begin < bucket_count; begin += wave_size) {
+        const size_t end = std::min(begin + wave_size, bucket_count);
+        std::vector<std::thread> threads;
+        for (size_t i = begin; i < end; ++i) {
+            auto & chunk = chunks[i - begin];
+            const auto path = detail::shuffle_bucket_path(temp_dir, i);
+            threads.push_back(std::thread([path, &chunk](){
+                detail::shuffle_bucket(path, chunk);
+            }));
+        }
+        for (auto & thread : threads) {
+            thread.join();
         }
-        for (const auto & message : chunk) {
-            shuffled.write_stream(message);
+        for (size_t i = begin; i < end; ++i) {
+            detail::shuffle_write(chunks[i - begin], shuffled);
+            chunks[i - begin].clear();
         }
     }
+    int status = rmdir(temp_dir.c_str());
+    LOOM_ASSERT_EQ(status, 0);
 }
 
 } // namespace loom
@@ -0,0 +1,77 @@
+// Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+// Copyright (c) 2015, Google, Inc.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// - Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// - Neither the name of Salesforce.com nor the names of its contributors
+//   may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+// OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+// TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#include <loom/args.hpp>
+#include <loom/protobuf_stream.hpp>
+
+const char * help_message =
+"Usage: slice ROWS_IN ROWS_OUT [BEGIN=0] [END=-1] [STRIDE=1024]"
+"\nArguments:"
+"\n  ROWS_IN       filename of input dataset stream (e.g. rows.pbs.gz)"
+"\n  ROWS_OUT      filename of output dataset stream (e.g. rows_out.pbsz)"
+"\n  BEGIN         position of first message to copy"
+"\n  END           position after last message to copy, or -1 for all"
+"\n  STRIDE        number of messages between indexed positions of ROWS_OUT"
+"\nNotes:"
+"\n  Any filename can end with .gz to indicate gzip compression."
+"\n  Any stream filename can end with .pbsz to indicate block compression."
+"\n  ROWS_IN is seeked via its index, if it has one."
+"\n  ROWS_OUT is written with an index sidecar, unless it is stdout."
+;
+
+int main (int argc, char ** argv)
+{
+    GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+    Args args(argc, argv, help_message);
+    const char * rows_in = args.pop();
+    const char * rows_out = args.pop();
+    const int64_t begin = args.pop_default(int64_t(0));
+    const int64_t end = args.pop_default(int64_t(-1));
+    const int stride = args.pop_default(
+        static_cast<int>(loom::protobuf::StreamIndex::default_stride));
+    args.done();
+
+    LOOM_ASSERT_LE(0, begin);
+    LOOM_ASSERT(end == -1 or begin <= end, "bad interval");
+    LOOM_ASSERT_LT(0, stride);
+
+    loom::protobuf::InFile in(rows_in);
+    loom::protobuf::OutFile out(rows_out);
+    out.enable_index(stride);
+    in.set_position(begin);
+    loom::protobuf::RawMessage raw;
+    for (int64_t i = begin; end == -1 or i < end; ++i) {
+        if (not in.try_read_stream(raw)) {
+            LOOM_ASSERT(end == -1, "too few messages in " << rows_in);
+            break;
+        }
+        out.write_stream(raw.data, raw.size);
+    }
+
+    return 0;
+}
@@ -38,7 +38,9 @@ const char * help_message =
 "\n  ROWS_IN       filename of input dataset stream (e.g. rows.pbs.gz)"
 "\n  ROWS_OUT      filename of output dataset stream (e.g. diffs.pbs.gz)"
 "\nNotes:"
+"\n  Each row is diffed against its nearest tare row."
 "\n  Any filename can end with .gz to indicate gzip compression."
+"\n  Any stream filename can end with .pbsz to indicate block compression."
 "\n  Any filename can be '-' or '-.gz' to indicate stdin/stdout."
 ;
 
@@ -61,11 +63,9 @@ int main (int argc, char ** argv)
     if (tares.size() == 0) {
         tares.resize(1);
         schema.clear(tares[0]);
-    } else if (tares.size() > 1) {
-        TODO("support multiple tare values in sparsify");
     }
 
-    loom::Differ differ(schema, tares[0]);
+    loom::Differ differ(schema, tares);
     differ.compress_rows(rows_in, rows_out);
 
     return 0;
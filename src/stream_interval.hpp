@@ -31,6 +31,8 @@
 #include <loom/common.hpp>
 #include <loom/protobuf.hpp>
 #include <loom/assignments.hpp>
+#include <loom/timer.hpp>
+#include <loom/logger.hpp>
 
 namespace loom
 {
@@ -41,7 +43,9 @@ public:
 
     StreamInterval (const char * rows_in) :
         unassigned_(rows_in),
-        assigned_(rows_in)
+        assigned_(rows_in),
+        unassigned_count_(0),
+        assigned_count_(0)
     {
     }
 
@@ -68,30 +72,89 @@ public:
         LOOM_ASSERT(assignments.row_count(), "nothing to initialize");
         LOOM_ASSERT(assigned_.is_file(), "only files support StreamInterval");
 
-        #pragma omp parallel sections
-        {
-            #pragma omp section
+        if (assigned_.index()) {
             seek_first_unassigned_row(assignments);
-
-            #pragma omp section
+            if (seek_first_assigned_row_indexed(assignments)) {
+                return;
+            }
+            assigned_.set_position(0);
             seek_first_assigned_row(assignments);
+        } else {
+            #pragma omp parallel sections
+            {
+                #pragma omp section
+                seek_first_unassigned_row(assignments);
+
+                #pragma omp section
+                seek_first_assigned_row(assignments);
+            }
         }
     }
 
+    void set_unzip_threads (size_t unzip_threads)
+    {
+        unassigned_.set_unzip_threads(unzip_threads);
+        assigned_.set_unzip_threads(unzip_threads);
+    }
+
+    void set_prefetch_bytes (uint64_t prefetch_bytes)
+    {
+        unassigned_.set_prefetch_bytes(prefetch_bytes);
+        assigned_.set_prefetch_bytes(prefetch_bytes);
+    }
+
     template<class Message>
     void read_unassigned (Message & message)
     {
+        Timer::Scope timer(unassigned_timer_);
         unassigned_.cyclic_read_stream(message);
+        ++unassigned_count_;
     }
 
     template<class Message>
     void read_assigned (Message & message)
     {
+        Timer::Scope timer(assigned_timer_);
         assigned_.cyclic_read_stream(message);
+        ++assigned_count_;
+    }
+
+    void log_metrics (Logger::Message & message)
+    {
+        auto & status = * message.mutable_rows();
+        log_cursor(
+            unassigned_,
+            unassigned_count_,
+            unassigned_timer_,
+            * status.mutable_unassigned());
+        log_cursor(
+            assigned_,
+            assigned_count_,
+            assigned_timer_,
+            * status.mutable_assigned());
     }
 
 private:
 
+    static void log_cursor (
+            protobuf::InFile & file,
+            size_t & count,
+            Timer & timer,
+            protobuf::LogMessage::Args::Rows::Cursor & status)
+    {
+        status.set_read_count(count);
+        status.set_stall_time(timer.total());
+        if (auto * prefetcher = file.page_prefetcher()) {
+            status.set_prefetch_bytes(prefetcher->take_fetched_bytes());
+            status.set_prefetch_time(prefetcher->take_fetch_time());
+        } else {
+            status.set_prefetch_bytes(0);
+            status.set_prefetch_time(0);
+        }
+        count = 0;
+        timer.clear();
+    }
+
     void seek_first_unassigned_row (const Assignments & assignments)
     {
         const auto last_assigned_rowid = assignments.rowids().back();
@@ -111,7 +174,7 @@ private:
         const auto first_assigned_rowid = assignments.rowids().front();
         protobuf::InFile peeker(unassigned_.filename());
         protobuf::Row row;
-        std::vector<char> unused;
+        protobuf::RawMessage unused;
 
         while (true) {
             bool success = peeker.try_read_stream(row);
@@ -123,8 +186,33 @@ private:
         }
     }
 
+    // assigned rows are a cyclic interval ending at the first unassigned row
+    bool seek_first_assigned_row_indexed (const Assignments & assignments)
+    {
+        const uint64_t message_count = assigned_.index()->message_count;
+        const uint64_t row_count = assignments.row_count();
+        LOOM_ASSERT_LE(row_count, message_count);
+        const uint64_t end = unassigned_.position();
+        const uint64_t begin = (end + message_count - row_count) % message_count;
+
+        protobuf::InFile peeker(assigned_.filename());
+        protobuf::Row row;
+        peeker.set_position(begin);
+        peeker.cyclic_read_stream(row);
+        if (row.id() != assignments.rowids().front()) {
+            return false;
+        }
+
+        assigned_.set_position(begin);
+        return true;
+    }
+
     protobuf::InFile unassigned_;
     protobuf::InFile assigned_;
+    size_t unassigned_count_;
+    size_t assigned_count_;
+    Timer unassigned_timer_;
+    Timer assigned_timer_;
 };
 
 } // namespace loom
@@ -30,13 +30,17 @@
 #include <loom/differ.hpp>
 
 const char * help_message =
-"Usage: tare SCHEMA_ROW_IN ROWS_IN TARES_OUT"
+"Usage: tare SCHEMA_ROW_IN ROWS_IN TARES_OUT [TARE_COUNT=1]"
 "\nArguments:"
 "\n  SCHEMA_ROW_IN filename of schema row (e.g. schema.pb.gz)"
 "\n  ROWS_IN       filename of input dataset stream (e.g. rows.pbs.gz)"
 "\n  TARES_OUT     filename of output tare rows (e.g. tares.pbs.gz)"
+"\n  TARE_COUNT    maximum number of tare rows to find"
 "\nNotes:"
+"\n  Finding multiple tares makes multiple passes over ROWS_IN,"
+"\n  so ROWS_IN must then be a file rather than stdin."
 "\n  Any filename can end with .gz to indicate gzip compression."
+"\n  Any stream filename can end with .pbsz to indicate block compression."
 "\n  Any filename can be '-' or '-.gz' to indicate stdin/stdout."
 ;
 
@@ -48,20 +52,33 @@ int main (int argc, char ** argv)
     const char * schema_row_in = args.pop();
     const char * rows_in = args.pop();
     const char * tares_out = args.pop();
+    const int tare_count = args.pop_default(1);
     args.done();
 
+    LOOM_ASSERT_LT(0, tare_count);
+
     loom::ProductValue value;
     loom::protobuf::InFile(schema_row_in).read(value);
     loom::ValueSchema schema;
     schema.load(value);
 
     loom::Differ differ(schema);
-    differ.add_rows(rows_in);
+    differ.add_rows(rows_in, tare_count);
 
+    // Every learned tare is written, even empty ones, since sparsify diffs
+    // each row against its nearest tare and rows nearest an empty tare
+    // would otherwise be diffed against another.  If every tare is empty,
+    // none are written, so that sparsify leaves rows undiffed.
+    const auto & learned = differ.get_tares();
+    bool nonempty = false;
+    for (const auto & tare : learned) {
+        nonempty = nonempty or schema.total_size(tare);
+    }
     loom::protobuf::OutFile tares(tares_out);
-    const auto & tare = differ.get_tare();
-    if (schema.total_size(tare)) {
-        tares.write_stream(tare);
+    if (nonempty) {
+        for (const auto & tare : learned) {
+            tares.write_stream(tare);
+        }
     }
 
     return 0;
@@ -0,0 +1,191 @@
+// Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+// Copyright (c) 2015, Google, Inc.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// - Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// - Neither the name of Salesforce.com nor the names of its contributors
+//   may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+// OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+// TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <loom/args.hpp>
+#include <deque>
+#include <random>
+#include <iostream>
+#include <loom/assignments.hpp>
+
+const char * help_message =
+"Usage: test_assignments [SEED=0]"
+"\nNotes:"
+"\n  Checks packed assignment queues against std::deque,"
+"\n  exercising bit width growth, ring buffer wraparound,"
+"\n  and copies of buffers on both sides of the mmap threshold."
+;
+
+namespace
+{
+
+template<class T>
+void assert_equal (
+        const loom::Assignments::Queue<T> & actual,
+        const std::deque<T> & expected)
+{
+    LOOM_ASSERT_EQ(actual.size(), expected.size());
+    LOOM_ASSERT_EQ(actual.empty(), expected.empty());
+    for (size_t i = 0; i < expected.size(); ++i) {
+        LOOM_ASSERT_EQ(actual[i], expected[i]);
+    }
+    if (not expected.empty()) {
+        LOOM_ASSERT_EQ(actual.front(), expected.front());
+        LOOM_ASSERT_EQ(actual.back(), expected.back());
+    }
+}
+
+// values grow through every bit width, while pops move the head around
+// the ring so that growth happens with wrapped contents
+template<class T>
+void test_width_growth (loom::rng_t & rng)
+{
+    loom::Assignments::Queue<T> actual;
+    std::deque<T> expected;
+    const size_t bits = 8 * sizeof(T);
+    for (size_t width = 0; width <= bits; ++width) {
+        const uint64_t max_value = width == 64 ? ~0UL : (1UL << width) - 1;
+        std::uniform_int_distribution<uint64_t> sample(0, max_value);
+        for (size_t i = 0; i < 100; ++i) {
+            const T t = static_cast<T>(i ? sample(rng) : max_value);
+            actual.push(t);
+            expected.push_back(t);
+            if (rng() % 3 == 0) {
+                LOOM_ASSERT_EQ(actual.pop(), expected.front());
+                expected.pop_front();
+            }
+        }
+        assert_equal(actual, expected);
+    }
+    while (not expected.empty()) {
+        LOOM_ASSERT_EQ(actual.pop(), expected.front());
+        expected.pop_front();
+    }
+    assert_equal(actual, expected);
+}
+
+// a queue at steady size keeps wrapping around without growing
+template<class T>
+void test_wraparound (loom::rng_t & rng)
+{
+    loom::Assignments::Queue<T> actual;
+    std::deque<T> expected;
+    for (size_t i = 0; i < 50; ++i) {
+        const T t = i ? rng() % 1000 : 999;
+        actual.push(t);
+        expected.push_back(t);
+    }
+    const size_t memory_bytes = actual.memory_bytes();
+    for (size_t i = 0; i < 1000; ++i) {
+        const T t = rng() % 1000;
+        actual.push(t);
+        expected.push_back(t);
+        LOOM_ASSERT_EQ(actual.pop(), expected.front());
+        expected.pop_front();
+        assert_equal(actual, expected);
+    }
+    LOOM_ASSERT_EQ(actual.memory_bytes(), memory_bytes);
+
+    LOOM_ASSERT(not actual.try_push(expected.front()), "pushed duplicate");
+    LOOM_ASSERT(actual.try_push(expected.front() + 1), "failed to push");
+    expected.push_back(expected.front() + 1);
+    assert_equal(actual, expected);
+
+    actual.clear();
+    expected.clear();
+    assert_equal(actual, expected);
+}
+
+// copies and moves must preserve wrapped contents, both for calloc'd
+// buffers and for buffers large enough to be mmapped
+template<class T>
+void test_copy (size_t size, loom::rng_t & rng)
+{
+    loom::Assignments::Queue<T> actual;
+    std::deque<T> expected;
+    for (size_t i = 0; i < size; ++i) {
+        const T t = static_cast<T>(rng());
+        actual.push(t);
+        expected.push_back(t);
+        if (i % 4 == 0) {
+            LOOM_ASSERT_EQ(actual.pop(), expected.front());
+            expected.pop_front();
+        }
+    }
+    assert_equal(actual, expected);
+
+    loom::Assignments::Queue<T> copied(actual);
+    assert_equal(copied, expected);
+
+    loom::Assignments::Queue<T> assigned;
+    assigned.push(1);
+    assigned = actual;
+    assert_equal(assigned, expected);
+
+    // copies are independent of their source
+    actual.push(1);
+    actual.pop();
+    copied.clear();
+    assert_equal(assigned, expected);
+
+    loom::Assignments::Queue<T> moved(std::move(assigned));
+    assert_equal(moved, expected);
+
+    loom::Assignments::Queue<T> small;
+    small.push(2);
+    moved = small;
+    assert_equal(moved, std::deque<T>(1, 2));
+}
+
+} // anonymous namespace
+
+int main (int argc, char ** argv)
+{
+    Args args(argc, argv, help_message);
+    const int seed = args.pop_default(0);
+    args.done();
+
+    loom::rng_t rng(seed);
+
+    test_width_growth<uint32_t>(rng);
+    test_width_growth<uint64_t>(rng);
+
+    test_wraparound<uint32_t>(rng);
+    test_wraparound<uint64_t>(rng);
+
+    // 2MB holds 2^18 64-bit values or 2^19 32-bit values
+    const size_t small_size = 1000;
+    const size_t large_size = 1000000;
+    test_copy<uint32_t>(small_size, rng);
+    test_copy<uint32_t>(large_size, rng);
+    test_copy<uint64_t>(small_size, rng);
+    test_copy<uint64_t>(large_size, rng);
+
+    std::cout << "assignment queues ok" << std::endl;
+
+    return 0;
+}
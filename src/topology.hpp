@@ -0,0 +1,243 @@
+// Copyright (c) 2014, Salesforce.com, Inc.  All rights reserved.
+// Copyright (c) 2015, Google, Inc.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// - Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+// - Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+// - Neither the name of Salesforce.com nor the names of its contributors
+//   may be used to endorse or promote products derived from this
+//   software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+// BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+// OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+// TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+// USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <sched.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <loom/common.hpp>
+
+namespace loom
+{
+
+// Topology lists the cpus this process may run on, grouped by numa node,
+// as reported by sched_getaffinity(2) and /sys/devices/system/node.
+// On machines without numa support all cpus are reported on node 0.
+
+class Topology
+{
+public:
+
+    struct Cpu
+    {
+        uint32_t cpu;
+        uint32_t node;
+    };
+
+    Topology () : placements_(), node_count_(0)
+    {
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed)) {
+            CPU_SET(0, &allowed);
+        }
+
+        // node numbers may have gaps, e.g. from offline nodes
+        std::vector<std::vector<uint32_t>> nodes;
+        for (uint32_t node : _list_nodes()) {
+            std::vector<uint32_t> cpus;
+            if (not _try_read_node_cpus(node, cpus)) {
+                continue;
+            }
+            nodes.resize(std::max<size_t>(nodes.size(), node + 1));
+            for (auto cpu : cpus) {
+                if (CPU_ISSET(cpu, &allowed)) {
+                    nodes[node].push_back(cpu);
+                }
+            }
+        }
+        if (nodes.empty()) {
+            nodes.resize(1);
+            for (uint32_t cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (CPU_ISSET(cpu, &allowed)) {
+                    nodes[0].push_back(cpu);
+                }
+            }
+        }
+
+        // interleave nodes, so that consecutive placements alternate nodes
+        for (size_t rank = 0;; ++rank) {
+            bool found = false;
+            for (size_t node = 0; node < nodes.size(); ++node) {
+                if (rank < nodes[node].size()) {
+                    placements_.push_back({nodes[node][rank], uint32_t(node)});
+                    found = true;
+                }
+            }
+            if (not found) {
+                break;
+            }
+        }
+        for (const auto & cpus : nodes) {
+            node_count_ += not cpus.empty();
+        }
+        if (placements_.empty()) {
+            placements_.push_back({0, 0});
+            node_count_ = 1;
+        }
+    }
+
+    size_t cpu_count () const { return placements_.size(); }
+    size_t node_count () const { return node_count_; }
+
+    const Cpu & place (size_t index) const
+    {
+        return placements_[index % placements_.size()];
+    }
+
+    static bool try_pin_current_thread (uint32_t cpu)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        pthread_t thread = pthread_self();
+        return pthread_setaffinity_np(thread, sizeof(cpus), &cpus) == 0;
+    }
+
+    // Returns whether pages sampled from the given range may lie off node,
+    // as reported by move_pages(2).  Pages not yet touched count as on node,
+    // since they will be placed by whichever thread touches them first.
+    // Where move_pages is unavailable this conservatively returns true.
+    static bool may_be_off_node (
+            const void * data,
+            size_t bytes,
+            uint32_t node)
+    {
+        if (bytes == 0) {
+            return false;
+        }
+#ifdef SYS_move_pages
+        enum { sample_count = 4 };
+        const uintptr_t page_mask = ~uintptr_t(sysconf(_SC_PAGESIZE) - 1);
+        const uintptr_t begin = reinterpret_cast<uintptr_t>(data);
+        void * pages[sample_count];
+        int status[sample_count];
+        for (size_t i = 0; i < sample_count; ++i) {
+            uintptr_t offset = (bytes - 1) * i / (sample_count - 1);
+            pages[i] = reinterpret_cast<void *>((begin + offset) & page_mask);
+        }
+        long error = syscall(
+            SYS_move_pages,
+            0,
+            sample_count,
+            pages,
+            nullptr,
+            status,
+            0);
+        if (error == 0) {
+            for (int s : status) {
+                if (s >= 0 and uint32_t(s) != node) {
+                    return true;
+                }
+            }
+            return false;
+        }
+#endif // SYS_move_pages
+        return true;
+    }
+
+private:
+
+    static std::vector<uint32_t> _list_nodes ()
+    {
+        std::vector<uint32_t> nodes;
+        if (DIR * dir = opendir("/sys/devices/system/node")) {
+            while (const dirent * entry = readdir(dir)) {
+                unsigned node;
+                char extra;
+                if (sscanf(entry->d_name, "node%u%c", &node, &extra) == 1) {
+                    nodes.push_back(node);
+                }
+            }
+            closedir(dir);
+        }
+        std::sort(nodes.begin(), nodes.end());
+        return nodes;
+    }
+
+    static bool _try_read_node_cpus (
+            size_t node,
+            std::vector<uint32_t> & cpus)
+    {
+        char filename[64];
+        snprintf(
+            filename,
+            sizeof(filename),
+            "/sys/devices/system/node/node%zu/cpulist",
+            node);
+        FILE * file = fopen(filename, "r");
+        if (not file) {
+            return false;
+        }
+
+        // format is a comma-separated list of ranges, e.g. 0-3,8-11
+        unsigned begin, end;
+        while (fscanf(file, "%u", &begin) == 1) {
+            end = begin;
+            int c = fgetc(file);
+            if (c == '-') {
+                if (fscanf(file, "%u", &end) != 1) {
+                    break;
+                }
+                c = fgetc(file);
+            }
+            for (uint32_t cpu = begin; cpu <= end; ++cpu) {
+                cpus.push_back(cpu);
+            }
+            if (c != ',') {
+                break;
+            }
+        }
+        fclose(file);
+        return true;
+    }
+
+    std::vector<Cpu> placements_;
+    size_t node_count_;
+};
+
+// Linux places pages on the numa node of the thread that first touches them.
+// Calling first_touch from a pinned thread copies an object's heap storage,
+// so that freshly mapped pages land on that thread's node.  This is best
+// effort: the allocator may reuse memory that another thread has touched.
+template<class T>
+inline void first_touch (T & t)
+{
+    T copy(t);
+    std::swap(t, copy);
+}
+
+} // namespace loom